@@ -0,0 +1,241 @@
+#include "batch.h"
+#include "compression.h"
+#include "outputindex.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+// Blocking FIFO with a capacity; close() wakes every waiter and makes pop()
+// return false once the queue has drained
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    bool push(T item) {
+        unique_lock<mutex> guard(lock);
+        notFull.wait(guard, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item) {
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    deque<T> items;
+    mutex lock;
+    condition_variable notEmpty, notFull;
+};
+
+struct BatchItem {
+    size_t index;
+    cv::Mat image;
+    CompressedOutput output;
+    string error;
+    chrono::steady_clock::time_point start;
+    CompressionStats stats;
+    uint64_t fileBytes = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    Thumbnail thumbnail = {0, 0, 0, vector<uint8_t>()};
+    uint64_t key = 0;        // Output index key, when there is an index
+    bool cached = false;     // entry's outputs are reused as they are
+    bool duplicate = false;  // An earlier job in the run has the same key and writes the outputs
+    bool written = false;    // The .bin is on disk and the side image still has to follow it
+    IndexEntry entry = IndexEntry();
+};
+
+// Packs a thumbnail of img, which is then free to be released
+static Thumbnail packThumbnail(const cv::Mat &img, unsigned maxSide) {
+    cv::Mat small = makeThumbnail(img, int(maxSide));
+    Thumbnail thumbnail = {uint32_t(small.cols), uint32_t(small.rows), uint32_t(small.channels()), vector<uint8_t>()};
+    size_t rowBytes = size_t(small.cols) * small.elemSize();
+    thumbnail.pixels.resize(rowBytes * small.rows);
+    for (int y = 0; y < small.rows; ++y) memcpy(&thumbnail.pixels[y * rowBytes], small.ptr(y), rowBytes);
+    return thumbnail;
+}
+
+BatchCompressor::BatchCompressor(unsigned workers, CompressionContext *context)
+    : workers(workers), context(context), thumbnailSize(0), index(nullptr), cancelled(false) {
+    if (this->workers == 0) this->workers = thread::hardware_concurrency();
+    if (this->workers == 0) this->workers = 1;
+    if (!this->context) this->context = &CompressionContext::shared();
+}
+
+void BatchCompressor::run(const vector<BatchJob> &jobs, const ResultCallback &onResult) {
+    unsigned decoders = max(1u, workers / 2);
+    unsigned encoders = max(1u, workers - workers / 2);
+    BoundedQueue<BatchItem> decoded(encoders);
+    BoundedQueue<BatchItem> encoded(encoders);
+    atomic<size_t> nextJob(0);
+    atomic<unsigned> decodersLeft(decoders), encodersLeft(encoders);
+    mutex claimLock;
+    unordered_set<uint64_t> claimed;  // Keys some job in this run is encoding
+
+    auto decodeStage = [&] {
+        size_t i;
+        while (!cancelled && (i = nextJob++) < jobs.size()) {
+            BatchItem item;
+            item.index = i;
+            item.start = chrono::steady_clock::now();
+            try {
+                // The bytes are hashed before they are decoded, which a cached
+                // or repeated source never is
+                vector<uint8_t> bytes = readImageFile(jobs[i].imagePath, &item.stats);
+                item.fileBytes = bytes.size();
+                // Hashing is left untimed, so Read stays what imread cost
+                if (index) {
+                    item.key = OutputIndex::key(bytes, jobs[i]);
+                    item.cached = index->lookup(item.key, item.entry);
+                    if (!item.cached) {
+                        lock_guard<mutex> guard(claimLock);
+                        item.duplicate = !claimed.insert(item.key).second;
+                    }
+                }
+                if (!item.cached && !item.duplicate) {
+                    item.image = decodeImageFile(bytes, &item.stats);
+                    item.width = uint32_t(item.image.cols);
+                    item.height = uint32_t(item.image.rows);
+                }
+            } catch (const exception &e) {
+                item.error = e.what();
+            }
+            if (!decoded.push(move(item))) break;
+        }
+        if (--decodersLeft == 0) decoded.close();
+    };
+
+    auto encode = [&](BatchItem &item) {
+        const BatchJob &job = jobs[item.index];
+        if (index) index->release(job.outputPath, job.imageFormat);
+        item.output = encodeCompressed(item.image, job.outputPath, job.compressionParams, *context, job.imageFormat,
+                                       job.target, &item.stats);
+        item.written = true;
+        // The one decode of the source also feeds the preview
+        if (thumbnailSize > 0) item.thumbnail = packThumbnail(item.image, thumbnailSize);
+    };
+
+    auto encodeStage = [&] {
+        BatchItem item;
+        while (decoded.pop(item)) {
+            if (item.error.empty() && !item.cached && !item.duplicate && !cancelled) {
+                try {
+                    encode(item);
+                } catch (const exception &e) {
+                    item.error = e.what();
+                }
+            }
+            item.image.release();
+            if (!encoded.push(move(item))) break;
+        }
+        if (--encodersLeft == 0) encoded.close();
+    };
+
+    vector<thread> threads;
+    for (unsigned i = 0; i < decoders; ++i) threads.emplace_back(decodeStage);
+    for (unsigned i = 0; i < encoders; ++i) threads.emplace_back(encodeStage);
+
+    // Written keys, with the error if writing failed, and the duplicates
+    // that arrived before the job they repeat was written
+    unordered_map<uint64_t, string> keyErrors;
+    unordered_map<uint64_t, vector<BatchItem>> waiting;
+
+    auto settle = [&](BatchItem &item) {
+        const BatchJob &job = jobs[item.index];
+        bool original = index && !item.cached && !item.duplicate;
+        if (item.error.empty() && item.duplicate) item.error = keyErrors[item.key];
+        BatchResult result = {item.index, job.imagePath, string(), false, item.error, item.fileBytes, 0, -1, 0,
+                              0, CompressionStats(), vector<uint8_t>(), item.width, item.height, Thumbnail(), false};
+        if (item.error.empty()) {
+            try {
+                bool reused = (item.cached || item.duplicate) &&
+                              index->restore(item.key, job.outputPath, item.entry, result.compressedImagePath);
+                if (reused) {
+                    result.compressedSize = item.entry.imageSize;
+                    result.imageQuality = item.entry.imageQuality;
+                    result.binSize = item.entry.binSize;
+                    result.width = item.entry.width;
+                    result.height = item.entry.height;
+                    result.cached = true;
+                } else {
+                    // The entry was rewritten by an earlier job since the
+                    // decode stage looked it up, so the source is coded here
+                    if (item.cached || item.duplicate) {
+                        item.image = loadImage(job.imagePath, &item.stats);
+                        result.width = uint32_t(item.image.cols);
+                        result.height = uint32_t(item.image.rows);
+                        encode(item);
+                        item.image.release();
+                    }
+                    result.compressedImagePath = writeCompressed(item.output, job.outputPath, &item.stats);
+                    result.compressedSize = item.output.image.size();
+                    result.imageQuality = item.output.imageQuality;
+                    result.compressedImage = move(item.output.image);
+                    result.binSize = item.stats.count(Counter::BinBytes);
+                    result.thumbnail = move(item.thumbnail);
+                    if (index) index->record(item.key, job.outputPath, result);
+                }
+                result.success = true;
+            } catch (const exception &e) {
+                result.error = e.what();
+            }
+        }
+        if (original) keyErrors[item.key] = result.error;
+        item.output = CompressedOutput();
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - item.start).count();
+        result.stats = item.stats;
+        return result;
+    };
+
+    // Writer stage runs on the calling thread
+    BatchItem item;
+    while (encoded.pop(item)) {
+        // Jobs whose .bin is already written get their side image, so a
+        // cancel leaves no .bin without one
+        if (item.error.empty() && cancelled && !item.written) continue;
+        if (item.duplicate && !keyErrors.count(item.key)) {
+            waiting[item.key].push_back(move(item));
+            continue;
+        }
+        bool original = index && !item.cached && !item.duplicate;
+        uint64_t key = item.key;
+        onResult(settle(item));
+        auto pending = original ? waiting.find(key) : waiting.end();
+        if (pending == waiting.end()) continue;
+        for (BatchItem &duplicate : pending->second) {
+            if (!cancelled) onResult(settle(duplicate));
+        }
+        waiting.erase(pending);
+    }
+
+    decoded.close();
+    encoded.close();
+    for (thread &t : threads) t.join();
+}
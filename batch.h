@@ -0,0 +1,95 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "metrics.h"
+#include "quality.h"
+
+using namespace std;
+
+class CompressionContext;
+class OutputIndex;
+
+struct BatchJob {
+    string imagePath;
+    string outputPath;
+    vector<int> compressionParams;
+    string imageFormat = "jpg";
+    QualityTarget target = QualityTarget();  // Replaces the quality in compressionParams unless Fixed
+};
+
+// Downscaled copy of a source image, 8-bit BGR rows packed tightly
+struct Thumbnail {
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    vector<uint8_t> pixels;
+};
+
+// Everything known about one job once it is done, so callers need not
+// open the source or its outputs again
+struct BatchResult {
+    size_t index;
+    string imagePath;
+    string compressedImagePath;
+    bool success;
+    string error;
+    uint64_t originalSize;
+    uint64_t compressedSize;
+    int imageQuality;  // Side image quality used, -1 for png
+    uint64_t binSize;
+    double seconds;
+    CompressionStats stats;  // Per-stage timings and coding counters
+    vector<uint8_t> compressedImage;  // Encoded side image, handed over instead of freed
+    uint32_t width;                   // Source dimensions, 0 if it failed to load
+    uint32_t height;
+    Thumbnail thumbnail;              // Empty unless a thumbnail size is set
+    bool cached;                      // Outputs reused through the output index, nothing was encoded
+};
+
+// Compresses many images through a three-stage pipeline: decode workers
+// load images, encode workers run the Huffman and JPEG encoders, streaming
+// each .bin to disk block by block, and a writer thread writes the side
+// images and reports the results. Bounded queues between the stages
+// cap how many decoded images are in memory at once.
+class BatchCompressor {
+public:
+    typedef function<void(const BatchResult &)> ResultCallback;
+
+    // 0 workers means one per hardware core. Block coding inside each image
+    // runs on context's pool and reuses its buffers from item to item;
+    // without a context CompressionContext::shared() is used.
+    explicit BatchCompressor(unsigned workers = 0, CompressionContext *context = nullptr);
+
+    // Processes every job and blocks until done or cancelled. onResult is
+    // called from pipeline threads, once per finished job, in completion order.
+    void run(const vector<BatchJob> &jobs, const ResultCallback &onResult);
+
+    // Each result carries a thumbnail of its source no larger than maxSide
+    // on either side, made from the already decoded image; 0 turns them off
+    void setThumbnailSize(unsigned maxSide) { thumbnailSize = maxSide; }
+
+    // Jobs whose source bytes and settings match an index entry reuse its
+    // outputs instead of being decoded and encoded, and jobs sharing a
+    // source with an earlier one in the run are linked to its outputs.
+    // Written outputs are recorded in the index; null turns this off.
+    void setOutputIndex(OutputIndex *index) { this->index = index; }
+
+    // Safe from any thread. Jobs whose .bin is already written are still
+    // finished and reported; the rest are dropped.
+    void cancel() { cancelled = true; }
+    bool isCancelled() const { return cancelled; }
+
+private:
+    unsigned workers;
+    CompressionContext *context;
+    unsigned thumbnailSize;
+    OutputIndex *index;
+    atomic<bool> cancelled;
+};
+
+#endif
@@ -0,0 +1,388 @@
+#include "compression.h"
+#include "crc32c.h"
+#include "histogram.h"
+#include "planes.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Self-contained throughput benchmarks for each pipeline stage over
+// generated images. Results print as a table and optionally as JSON, so
+// runs from different releases can be compared.
+
+static void printUsage(const char *program) {
+    cerr << "Usage: " << program << " [options]\n"
+         << "\n"
+         << "Options:\n"
+         << "  --json FILE         also write the results as JSON\n"
+         << "  --sizes WxH,...     image sizes (default 640x480,1920x1080,3840x2160)\n"
+         << "  --filter TEXT       only run benchmarks whose name contains TEXT\n"
+         << "  --min-time S        minimum seconds spent per benchmark (default 0.5)\n"
+         << "  -j, --threads N     worker threads (default: one per core)\n"
+         << "  -h, --help          show this help\n";
+}
+
+struct ImageSize {
+    int width;
+    int height;
+};
+
+struct SyntheticImage {
+    string kind;
+    cv::Mat pixels;
+};
+
+struct Result {
+    string stage;
+    string image;
+    int width;
+    int height;
+    int channels;
+    size_t iterations;
+    double seconds;  // Median time of one iteration
+    double megabytesPerSecond;
+    double nsPerPixel;
+};
+
+// Sends cout to another stream until it goes out of scope, even by an exception
+class CoutRedirect {
+public:
+    explicit CoutRedirect(ostream &to) : saved(cout.rdbuf(to.rdbuf())) {}
+    ~CoutRedirect() { cout.rdbuf(saved); }
+
+    CoutRedirect(const CoutRedirect &) = delete;
+    CoutRedirect &operator=(const CoutRedirect &) = delete;
+
+private:
+    streambuf *saved;
+};
+
+// Uniform noise: the worst case, close to 8 bits per byte
+static cv::Mat noiseImage(int width, int height, mt19937 &rng) {
+    cv::Mat img(height, width, CV_8UC3);
+    for (int y = 0; y < height; ++y) {
+        uint8_t *row = img.ptr<uint8_t>(y);
+        for (int x = 0; x < width * 3; ++x) row[x] = uint8_t(rng());
+    }
+    return img;
+}
+
+// Smooth diagonal ramps, a different direction per channel
+static cv::Mat gradientImage(int width, int height) {
+    cv::Mat img(height, width, CV_8UC3);
+    for (int y = 0; y < height; ++y) {
+        uint8_t *row = img.ptr<uint8_t>(y);
+        for (int x = 0; x < width; ++x) {
+            row[x * 3] = uint8_t(255 * x / max(1, width - 1));
+            row[x * 3 + 1] = uint8_t(255 * y / max(1, height - 1));
+            row[x * 3 + 2] = uint8_t(255 * (x + y) / max(1, width + height - 2));
+        }
+    }
+    return img;
+}
+
+static cv::Mat flatImage(int width, int height) {
+    cv::Mat img(height, width, CV_8UC3);
+    for (int y = 0; y < height; ++y) {
+        uint8_t *row = img.ptr<uint8_t>(y);
+        for (int x = 0; x < width; ++x) {
+            row[x * 3] = 200;
+            row[x * 3 + 1] = 120;
+            row[x * 3 + 2] = 40;
+        }
+    }
+    return img;
+}
+
+// Low-frequency shading with sensor-like noise and a few hard-edged objects
+static cv::Mat photoImage(int width, int height, mt19937 &rng) {
+    normal_distribution<double> grain(0.0, 3.0);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    struct Box { int x0, y0, x1, y1; uint8_t colour[3]; };
+    vector<Box> boxes(12);
+    for (Box &box : boxes) {
+        box.x0 = int(unit(rng) * width);
+        box.y0 = int(unit(rng) * height);
+        box.x1 = box.x0 + int(unit(rng) * width / 4);
+        box.y1 = box.y0 + int(unit(rng) * height / 4);
+        for (uint8_t &c : box.colour) c = uint8_t(rng());
+    }
+
+    cv::Mat img(height, width, CV_8UC3);
+    for (int y = 0; y < height; ++y) {
+        uint8_t *row = img.ptr<uint8_t>(y);
+        double v = double(y) / height;
+        for (int x = 0; x < width; ++x) {
+            double u = double(x) / width;
+            double shade = 0.5 + 0.25 * sin(6.0 * u + 2.0 * v) + 0.15 * cos(9.0 * v - 3.0 * u);
+            const uint8_t *boxColour = nullptr;
+            for (const Box &box : boxes) {
+                if (x >= box.x0 && x < box.x1 && y >= box.y0 && y < box.y1) boxColour = box.colour;
+            }
+            for (int c = 0; c < 3; ++c) {
+                double base = boxColour ? boxColour[c] * (0.8 + 0.2 * shade) : 255.0 * shade * (0.7 + 0.15 * c);
+                row[x * 3 + c] = uint8_t(min(255.0, max(0.0, base + grain(rng))));
+            }
+        }
+    }
+    return img;
+}
+
+static vector<SyntheticImage> syntheticImages(const ImageSize &size) {
+    mt19937 rng(size.width * 31 + size.height);
+    return {
+        {"noise", noiseImage(size.width, size.height, rng)},
+        {"gradient", gradientImage(size.width, size.height)},
+        {"flat", flatImage(size.width, size.height)},
+        {"photo", photoImage(size.width, size.height, rng)},
+    };
+}
+
+// Runs body until minTime has passed (at least three times) and returns
+// the median time of one run
+static double timeIterations(const function<void()> &body, double minTime, size_t &iterations) {
+    vector<double> times;
+    double total = 0;
+    while (times.size() < 3 || total < minTime) {
+        auto start = chrono::steady_clock::now();
+        body();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        times.push_back(seconds);
+        total += seconds;
+    }
+    iterations = times.size();
+    sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+static PixelView matView(const cv::Mat &img) {
+    return {img.ptr<uint8_t>(0), size_t(img.cols) * img.channels(), size_t(img.rows), img.step};
+}
+
+static void writeJson(ostream &out, const vector<Result> &results, unsigned threads) {
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    out << "{\n  \"context\": {\n"
+        << "    \"date\": \"" << date << "\",\n"
+        << "    \"threads\": " << threads << ",\n"
+#if defined(__clang__)
+        << "    \"compiler\": \"clang " << __clang_major__ << "." << __clang_minor__ << "\",\n"
+#elif defined(__GNUC__)
+        << "    \"compiler\": \"gcc " << __GNUC__ << "." << __GNUC_MINOR__ << "\",\n"
+#endif
+#ifdef NDEBUG
+        << "    \"assertions\": false\n"
+#else
+        << "    \"assertions\": true\n"
+#endif
+        << "  },\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        out << "    {\"name\": " << jsonString(r.stage + "/" + r.image + "/" + to_string(r.width) + "x" +
+                                              to_string(r.height)) << ", "
+            << "\"stage\": " << jsonString(r.stage) << ", \"image\": " << jsonString(r.image) << ", "
+            << "\"width\": " << r.width << ", \"height\": " << r.height << ", \"channels\": " << r.channels << ", "
+            << "\"iterations\": " << r.iterations << ", \"seconds\": " << r.seconds << ", "
+            << "\"mb_per_s\": " << r.megabytesPerSecond << ", \"ns_per_pixel\": " << r.nsPerPixel << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+static bool parseSizes(const string &text, vector<ImageSize> &sizes) {
+    sizes.clear();
+    stringstream list(text);
+    string item;
+    while (getline(list, item, ',')) {
+        int width = 0, height = 0;
+        char x = 0, extra = 0;
+        if (sscanf(item.c_str(), "%d%c%d%c", &width, &x, &height, &extra) != 3 || x != 'x' || width <= 0 || height <= 0) {
+            return false;
+        }
+        sizes.push_back({width, height});
+    }
+    return !sizes.empty();
+}
+
+int main(int argc, char *argv[]) {
+    string jsonPath, filter;
+    vector<ImageSize> sizes = {{640, 480}, {1920, 1080}, {3840, 2160}};
+    double minTime = 0.5;
+    unsigned threads = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg == "--json" && hasValue) {
+            jsonPath = argv[++i];
+        } else if (arg == "--filter" && hasValue) {
+            filter = argv[++i];
+        } else if (arg == "--sizes" && hasValue) {
+            if (!parseSizes(argv[++i], sizes)) {
+                cerr << "Invalid sizes: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--min-time" && hasValue) {
+            minTime = atof(argv[++i]);
+        } else if ((arg == "-j" || arg == "--threads") && hasValue) {
+            threads = unsigned(atoi(argv[++i]));
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    ThreadPool pool(threads);
+    CompressionContext context(pool);
+    error_code ec;
+    fs::path workDir = fs::temp_directory_path(ec) / ("huffman-bench-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    fs::create_directories(workDir, ec);
+    vector<Result> results;
+
+    printf("%-18s %-9s %-11s %8s %12s %12s\n", "stage", "image", "size", "iters", "MB/s", "ns/pixel");
+    for (const ImageSize &size : sizes) {
+        for (const SyntheticImage &synthetic : syntheticImages(size)) {
+            const cv::Mat &img = synthetic.pixels;
+            PixelView pixels = matView(img);
+            size_t bytes = pixels.size(), pixelCount = size_t(img.cols) * img.rows;
+
+            // Shared inputs for the stages measured in isolation
+            Histogram freq = {};
+            countFrequencies(pixels, freq);
+            CodeLengths lengths = buildCodeLengths(freq);
+            CodeTable codes = canonicalCodes(lengths);
+            uint64_t bitCount = 0;
+            vector<uint8_t> coded = encode(pixels, codes, bitCount);
+            HuffmanDecoder decoder(lengths);
+            vector<uint8_t> decoded(bytes);
+            // The interleaved layout is for tile-sized streams, so the image is
+            // coded in chunks of one default tile's bytes
+            size_t chunkBytes = size_t(kDefaultBlockRows) * kDefaultBlockCols * img.channels();
+            vector<vector<uint8_t>> chunks;
+            for (size_t pos = 0; pos < bytes; pos += chunkBytes) {
+                uint64_t bits = 0;
+                size_t n = min(chunkBytes, bytes - pos);
+                chunks.push_back(encodeInterleaved(PixelView{pixels.data + pos, n, 1, n}, codes, bits));
+            }
+            vector<uint8_t> planeBytes(bytes);
+            uint8_t *planes[kMaxPlanes];
+            for (int c = 0; c < img.channels(); ++c) planes[c] = planeBytes.data() + c * pixelCount;
+            EncodedImage encoded = encodeImage(pixels, img.cols, img.channels(), pool);
+            string imagePath = (workDir / (synthetic.kind + ".ppm")).string();
+            string outputPath = (workDir / synthetic.kind).string();
+            string binPath = (workDir / (synthetic.kind + "-codec.bin")).string();
+            cv::imwrite(imagePath, img);
+            // Kept across iterations, so the pooled stages run in the steady
+            // state a batch reaches once it has seen its largest image
+            BufferPool buffers;
+            auto writeBin = [&](BufferPool *from) {
+                EncodedImageWriter writer(binPath, nullptr, from);
+                EncodeOptions options;
+                options.buffers = from;
+                encodeImage(pixels, img.cols, img.channels(), pool, writer, options);
+                writer.finish();
+            };
+
+            vector<pair<string, function<void()>>> stages = {
+                {"histogram", [&] {
+                    Histogram h = {};
+                    countFrequencies(pixels, h);
+                }},
+                {"planes", [&] {
+                    for (size_t y = 0; y < pixels.rows; ++y) {
+                        uint8_t *rowPlanes[kMaxPlanes];
+                        for (int c = 0; c < img.channels(); ++c) rowPlanes[c] = planes[c] + y * img.cols;
+                        deinterleave(pixels.row(y), img.cols, img.channels(), rowPlanes);
+                    }
+                }},
+                {"planes_scalar", [&] {
+                    for (size_t y = 0; y < pixels.rows; ++y) {
+                        uint8_t *rowPlanes[kMaxPlanes];
+                        for (int c = 0; c < img.channels(); ++c) rowPlanes[c] = planes[c] + y * img.cols;
+                        deinterleaveScalar(pixels.row(y), img.cols, img.channels(), rowPlanes);
+                    }
+                }},
+                {"crc32c", [&] {
+                    uint32_t crc = 0;
+                    for (size_t y = 0; y < pixels.rows; ++y) crc = crc32c(pixels.row(y), pixels.rowBytes, crc);
+                }},
+                {"crc32c_scalar", [&] {
+                    uint32_t crc = 0;
+                    for (size_t y = 0; y < pixels.rows; ++y) crc = crc32cScalar(pixels.row(y), pixels.rowBytes, crc);
+                }},
+                {"tree", [&] { buildCodeLengths(freq); }},
+                {"encode", [&] {
+                    uint64_t bits = 0;
+                    encode(pixels, codes, bits);
+                }},
+                {"decode", [&] {
+                    BitReader reader(coded.data(), coded.size());
+                    decoder.decode(reader, decoded.data(), decoded.size());
+                }},
+                {"decode_x4", [&] {
+                    for (size_t c = 0; c < chunks.size(); ++c) {
+                        size_t pos = c * chunkBytes;
+                        decoder.decodeInterleaved(chunks[c].data(), chunks[c].size(), decoded.data() + pos,
+                                                  min(chunkBytes, bytes - pos));
+                    }
+                }},
+                {"codec_enc", [&] { encodeImage(pixels, img.cols, img.channels(), pool); }},
+                {"codec_dec", [&] {
+                    decodeImage(encoded, MutablePixelView{decoded.data(), pixels.rowBytes, pixels.rows, pixels.rowBytes},
+                                pool);
+                }},
+                {"codec_dec_pooled", [&] {
+                    decodeImage(encoded, MutablePixelView{decoded.data(), pixels.rowBytes, pixels.rows, pixels.rowBytes},
+                                pool, &buffers);
+                }},
+                {"codec_write", [&] { writeBin(nullptr); }},
+                {"codec_write_pooled", [&] { writeBin(&buffers); }},
+                {"compress", [&] {
+                    // compressImage() reports progress on cout; keep it out of the table
+                    ostringstream sink;
+                    CoutRedirect quiet(sink);
+                    compressImage(imagePath, outputPath, {cv::IMWRITE_JPEG_QUALITY, 50}, QualityTarget(), nullptr,
+                                  context);
+                }},
+            };
+
+            for (const auto &stage : stages) {
+                string name = stage.first + "/" + synthetic.kind;
+                if (!filter.empty() && name.find(filter) == string::npos) continue;
+                Result r{stage.first, synthetic.kind, img.cols, img.rows, img.channels(), 0, 0, 0, 0};
+                r.seconds = timeIterations(stage.second, minTime, r.iterations);
+                r.megabytesPerSecond = bytes / r.seconds / (1024.0 * 1024.0);
+                r.nsPerPixel = r.seconds * 1e9 / pixelCount;
+                printf("%-18s %-9s %5dx%-5d %8zu %12.1f %12.3f\n", r.stage.c_str(), r.image.c_str(), r.width, r.height,
+                       r.iterations, r.megabytesPerSecond, r.nsPerPixel);
+                fflush(stdout);
+                results.push_back(r);
+            }
+        }
+    }
+    fs::remove_all(workDir, ec);
+
+    if (!jsonPath.empty()) {
+        ofstream out(jsonPath);
+        writeJson(out, results, pool.size());
+        if (!out) {
+            cerr << "Error writing " << jsonPath << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
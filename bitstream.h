@@ -0,0 +1,134 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HUFFMAN_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define HUFFMAN_UNLIKELY(x) (x)
+#endif
+
+inline uint64_t loadBE64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(v);
+#else
+    uint64_t r = 0;
+    for (int i = 0; i < 8; ++i) r = (r << 8) | p[i];
+    return r;
+#endif
+}
+
+inline void storeBE64(uint8_t *p, uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, sizeof(v));
+#else
+    for (int i = 7; i >= 0; --i) { p[i] = uint8_t(v); v >>= 8; }
+#endif
+}
+
+// MSB-first bit packer. Bits collect in a 64-bit accumulator and are
+// appended to the output one whole word at a time.
+class BitWriter {
+public:
+    explicit BitWriter(vector<uint8_t> &out) : out(out), acc(0), count(0), total(0) {}
+
+    // Appends the low n bits of value, n <= 32.
+    void writeBits(uint64_t value, unsigned n) {
+        total += n;
+        unsigned space = 64 - count;
+        if (n < space) {
+            acc = (acc << n) | value;
+            count += n;
+            return;
+        }
+        unsigned spill = n - space;
+        acc = (acc << space) | (value >> spill);
+        size_t pos = out.size();
+        out.resize(pos + 8);
+        storeBE64(out.data() + pos, acc);
+        acc = value & ((uint64_t(1) << spill) - 1);
+        count = spill;
+    }
+
+    // Flushes the remaining bits, zero-padding the last byte, and returns
+    // the number of valid bits written.
+    uint64_t finish() {
+        if (count > 0) {
+            uint64_t word = acc << (64 - count);
+            for (unsigned i = 0; i < count; i += 8) {
+                out.push_back(uint8_t(word >> 56));
+                word <<= 8;
+            }
+            acc = 0;
+            count = 0;
+        }
+        return total;
+    }
+
+    uint64_t bitCount() const { return total; }
+
+private:
+    vector<uint8_t> &out;
+    uint64_t acc;
+    unsigned count;
+    uint64_t total;
+};
+
+// MSB-first bit reader matching BitWriter. peekBits() can look up to 56
+// bits ahead; reads past the end of the buffer return zero bits.
+class BitReader {
+public:
+    BitReader(const uint8_t *data, size_t size) : data(data), size(size), pos(0), acc(0), count(0) {
+        refill();
+    }
+
+    void refill() {
+        if (pos + 8 <= size) {
+            acc |= loadBE64(data + pos) >> count;
+            pos += (63 - count) >> 3;
+            count |= 56;
+        } else {
+            while (count <= 56 && pos < size) {
+                acc |= uint64_t(data[pos++]) << (56 - count);
+                count += 8;
+            }
+            if (pos >= size) count = 64;
+        }
+    }
+
+    // Returns the next n bits (1 <= n <= 56) without consuming them.
+    uint64_t peekBits(unsigned n) const { return acc >> (64 - n); }
+
+    void skipBits(unsigned n) {
+        acc <<= n;
+        count -= n;
+    }
+
+    uint64_t readBits(unsigned n) {
+        if (count < n) refill();
+        uint64_t v = peekBits(n);
+        skipBits(n);
+        return v;
+    }
+
+    // Bits currently buffered and ready for peekBits().
+    unsigned available() const { return count; }
+
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    unsigned count;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "bufferpool.h"
+#include <algorithm>
+
+using namespace std;
+
+// Class c holds vectors of at least classBytes(c) bytes: 16, 20, 24, 28,
+// 32, 40, ... so a request never gets more than a quarter extra
+static const unsigned kMinClassBits = 4;
+static const unsigned kClassesPerDoubling = 4;
+// A request may be served from this many classes above its own, so a run
+// reuses the buffers of a slightly larger image instead of allocating
+static const unsigned kClassReach = kClassesPerDoubling;
+
+static unsigned highBit(size_t n) {
+    unsigned bit = 0;
+    while (n >> (bit + 1)) ++bit;
+    return bit;
+}
+
+static size_t classBytes(unsigned c) {
+    unsigned bits = kMinClassBits + c / kClassesPerDoubling;
+    return (size_t(1) << bits) + (c % kClassesPerDoubling) * (size_t(1) << (bits - 2));
+}
+
+// Largest class a vector of bytes fits, for bytes >= 16
+static unsigned floorClass(size_t bytes) {
+    unsigned bits = highBit(bytes);
+    unsigned step = unsigned((bytes - (size_t(1) << bits)) >> (bits - 2));
+    return (bits - kMinClassBits) * kClassesPerDoubling + step;
+}
+
+// Smallest class that holds bytes
+static unsigned ceilClass(size_t bytes) {
+    if (bytes <= classBytes(0)) return 0;
+    unsigned c = floorClass(bytes);
+    return classBytes(c) == bytes ? c : c + 1;
+}
+
+static void subtractClamped(atomic<size_t> &value, size_t n) {
+    size_t old = value.load();
+    while (!value.compare_exchange_weak(old, old - min(old, n))) {
+    }
+}
+
+static void raiseTo(atomic<size_t> &peak, size_t n) {
+    size_t old = peak.load();
+    while (old < n && !peak.compare_exchange_weak(old, n)) {
+    }
+}
+
+template <class T>
+vector<T> BufferPool::take(FreeLists<T> &lists, size_t capacity) {
+    vector<T> items;
+    unsigned first = ceilClass(capacity * sizeof(T));
+    if (first >= kClassCount) {
+        items.reserve(capacity);
+        return items;
+    }
+    unsigned last = min(first + kClassReach, kClassCount - 1);
+    for (unsigned c = first; c <= last && items.capacity() == 0; ++c) {
+        lock_guard<mutex> guard(lists.locks[c]);
+        if (lists.parked[c].empty()) continue;
+        items.swap(lists.parked[c].back());
+        lists.parked[c].pop_back();
+    }
+    if (items.capacity() > 0) {
+        subtractClamped(parkedBytes, items.capacity() * sizeof(T));
+    } else {
+        // Rounded up to the class size, so the vector is filed back under
+        // the class the next such request looks in
+        items.reserve((classBytes(first) + sizeof(T) - 1) / sizeof(T));
+    }
+    lentBytes += items.capacity() * sizeof(T);
+    raiseTo(peakBytes, parkedBytes + lentBytes);
+    return items;
+}
+
+template <class T>
+void BufferPool::give(FreeLists<T> &lists, vector<T> &items) {
+    size_t held = items.capacity() * sizeof(T);
+    if (held == 0) return;
+    // A vector may have grown while lent, so the peak is taken again here
+    subtractClamped(lentBytes, held);
+    if (held < classBytes(0)) {
+        vector<T>().swap(items);
+        return;
+    }
+    items.clear();
+    unsigned c = min(floorClass(held), kClassCount - 1);
+    {
+        lock_guard<mutex> guard(lists.locks[c]);
+        lists.parked[c].emplace_back();
+        lists.parked[c].back().swap(items);
+    }
+    parkedBytes += held;
+    raiseTo(peakBytes, parkedBytes + lentBytes);
+}
+
+vector<uint8_t> BufferPool::acquire(size_t capacity) {
+    return take(bytes, capacity);
+}
+
+vector<Histogram> BufferPool::acquireHistograms(size_t capacity) {
+    return take(histograms, capacity);
+}
+
+vector<HuffmanDecoder::Entry> BufferPool::acquireTable(size_t capacity) {
+    return take(tables, capacity);
+}
+
+void BufferPool::release(vector<uint8_t> &buffer) {
+    give(bytes, buffer);
+}
+
+void BufferPool::release(vector<Histogram> &histograms) {
+    give(this->histograms, histograms);
+}
+
+void BufferPool::release(vector<HuffmanDecoder::Entry> &table) {
+    give(tables, table);
+}
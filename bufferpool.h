@@ -0,0 +1,100 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "histogram.h"
+#include "huffman.h"
+
+using namespace std;
+
+// Storage recycled between tiles and images: the tile scratch the encoder
+// extracts pixels into, the streams, selectors and row predictors it codes
+// them into, the per-tile histograms its tables are built from, and the
+// decoder's lookup tables and plane scratch. A released vector keeps its
+// capacity, so once a run has seen its largest image none of these reach
+// the heap.
+//
+// Free vectors are filed by capacity in size classes a quarter of a power
+// of two apart, each behind its own lock. A request is served from the
+// smallest class sure to hold it, or one of the next few, so it costs the
+// same however many vectors are parked, and threads asking for different
+// sizes never wait on each other. Safe to share between threads.
+class BufferPool {
+public:
+    BufferPool() : parkedBytes(0), lentBytes(0), peakBytes(0) {}
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // An empty vector with room for at least capacity elements
+    vector<uint8_t> acquire(size_t capacity);
+    vector<Histogram> acquireHistograms(size_t capacity);
+    vector<HuffmanDecoder::Entry> acquireTable(size_t capacity);
+    // Takes a vector back and leaves it empty; vectors without capacity are ignored
+    void release(vector<uint8_t> &buffer);
+    void release(vector<Histogram> &histograms);
+    void release(vector<HuffmanDecoder::Entry> &table);
+
+    // Peak capacity, in bytes, of the vectors lent out and parked at once
+    size_t highWaterBytes() const { return peakBytes; }
+
+    // Classes from 16 bytes up to 2^48
+    static const unsigned kClassCount = 4 * (48 - 4);
+
+private:
+    template <class T>
+    struct FreeLists {
+        mutex locks[kClassCount];
+        vector<vector<T>> parked[kClassCount];
+    };
+
+    template <class T>
+    vector<T> take(FreeLists<T> &lists, size_t capacity);
+    template <class T>
+    void give(FreeLists<T> &lists, vector<T> &items);
+
+    FreeLists<uint8_t> bytes;
+    FreeLists<Histogram> histograms;
+    FreeLists<HuffmanDecoder::Entry> tables;
+    atomic<size_t> parkedBytes;
+    atomic<size_t> lentBytes;
+    atomic<size_t> peakBytes;
+};
+
+// Each falls back to the heap when no pool is given
+inline vector<uint8_t> acquireBuffer(BufferPool *pool, size_t capacity) {
+    if (pool) return pool->acquire(capacity);
+    vector<uint8_t> buffer;
+    buffer.reserve(capacity);
+    return buffer;
+}
+
+inline void releaseBuffer(BufferPool *pool, vector<uint8_t> &buffer) {
+    if (pool) {
+        pool->release(buffer);
+    } else {
+        vector<uint8_t>().swap(buffer);
+    }
+}
+
+// count histograms, all zero
+inline vector<Histogram> acquireHistograms(BufferPool *pool, size_t count) {
+    vector<Histogram> histograms;
+    if (pool) histograms = pool->acquireHistograms(count);
+    histograms.assign(count, Histogram());
+    return histograms;
+}
+
+inline void releaseHistograms(BufferPool *pool, vector<Histogram> &histograms) {
+    if (pool) {
+        pool->release(histograms);
+    } else {
+        vector<Histogram>().swap(histograms);
+    }
+}
+
+#endif
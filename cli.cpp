@@ -0,0 +1,312 @@
+#include "batch.h"
+#include "compression.h"
+#include "outputindex.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static void printUsage(const char *program) {
+    cerr << "Usage: " << program << " [options] <image|directory>...\n"
+         << "\n"
+         << "Options:\n"
+         << "  -o, --output DIR    output directory (default ../output/)\n"
+         << "  -q, --quality N     side image quality 1-100 (default 50)\n"
+         << "  -j, --threads N     worker threads (default: one per core)\n"
+         << "  -f, --format FMT    side image format: jpg, png or webp (default jpg)\n"
+         << "      --target-size N\n"
+         << "                      pick the highest quality whose side image is at most\n"
+         << "                      N bytes; K and M suffixes are accepted\n"
+         << "      --min-ssim X    pick the lowest quality with SSIM of at least X (0-1)\n"
+         << "      --min-psnr DB   pick the lowest quality with PSNR of at least DB\n"
+         << "  -s, --stream        read PGM/PPM input a strip at a time and write only\n"
+         << "                      the .bin, for images larger than memory\n"
+         << "      --force         recompress every image, including those the output\n"
+         << "                      directory's index says are unchanged since the last run\n"
+         << "      --stats FILE    write per-image stage timings and counters as JSON\n"
+         << "  -h, --help          show this help\n";
+}
+
+static bool isPnmFile(const fs::path &path) {
+    string ext = path.extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".pgm" || ext == ".ppm" || ext == ".pnm";
+}
+
+static bool isImageFile(const fs::path &path) {
+    string ext = path.extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" || isPnmFile(path);
+}
+
+static bool parseNumber(const string &text, int minValue, int maxValue, int &value) {
+    char *end = nullptr;
+    long parsed = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || parsed < minValue || parsed > maxValue) return false;
+    value = int(parsed);
+    return true;
+}
+
+static bool parseDecimal(const string &text, double minValue, double maxValue, double &value) {
+    char *end = nullptr;
+    double parsed = strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || !(parsed >= minValue && parsed <= maxValue)) return false;
+    value = parsed;
+    return true;
+}
+
+// Byte count with an optional K or M (binary) suffix
+static bool parseByteSize(string text, double &value) {
+    double scale = 1;
+    if (!text.empty() && (text.back() == 'K' || text.back() == 'k')) scale = 1024;
+    if (!text.empty() && (text.back() == 'M' || text.back() == 'm')) scale = 1024 * 1024;
+    if (scale != 1) text.pop_back();
+    if (!parseDecimal(text, 1, 1e12, value)) return false;
+    value *= scale;
+    return true;
+}
+
+// Output base names for sources, normally their stems. Sources sharing a
+// stem, e.g. img.png and img.jpg or a/img.png and b/img.png, keep their
+// extension and then a counter as well, so no two jobs write one output.
+static vector<string> outputNames(const vector<fs::path> &sources) {
+    map<string, size_t> stemCount;
+    for (const fs::path &source : sources) stemCount[source.stem().string()]++;
+    set<string> taken;
+    vector<string> names;
+    for (const fs::path &source : sources) {
+        string name = source.stem().string();
+        string extension = source.extension().string();
+        if (stemCount[name] > 1 && !extension.empty()) name += "_" + extension.substr(1);
+        string unique = name;
+        for (int n = 2; !taken.insert(unique).second; ++n) unique = name + "-" + to_string(n);
+        names.push_back(unique);
+    }
+    return names;
+}
+
+static vector<int> compressionParams(const string &format, int quality) {
+    if (format == "png") return {cv::IMWRITE_PNG_COMPRESSION, 9 - quality * 9 / 100};
+    if (format == "webp") return {cv::IMWRITE_WEBP_QUALITY, quality};
+    return {cv::IMWRITE_JPEG_QUALITY, quality};
+}
+
+static string statsEntry(const string &imagePath, double seconds, const CompressionStats &stats) {
+    return "{\"image\": " + jsonString(imagePath) + ", \"total_seconds\": " + to_string(seconds) +
+           ", \"stats\": " + stats.toJson() + "}";
+}
+
+// Writes the collected entries as one JSON array; an empty path writes nothing
+static bool writeStats(const string &path, const vector<string> &entries) {
+    if (path.empty()) return true;
+    ofstream out(path);
+    out << "[\n";
+    for (size_t i = 0; i < entries.size(); ++i) out << "  " << entries[i] << (i + 1 < entries.size() ? ",\n" : "\n");
+    out << "]\n";
+    if (!out) {
+        cerr << "Error writing " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+// One file at a time, each spread over the whole pool
+static int runStreaming(const vector<BatchJob> &jobs, CompressionContext &context, bool inputError,
+                        const string &statsPath) {
+    vector<string> statsEntries;
+    int failCount = 0;
+    uint64_t totalIn = 0, totalBin = 0;
+    auto start = chrono::steady_clock::now();
+    for (const BatchJob &job : jobs) {
+        if (!isPnmFile(job.imagePath)) {
+            failCount++;
+            cerr << "FAIL " << job.imagePath << ": streaming needs PGM or PPM input\n";
+            continue;
+        }
+        auto fileStart = chrono::steady_clock::now();
+        CompressionStats stats;
+        try {
+            compressImageStreaming(job.imagePath, job.outputPath, context, &stats);
+        } catch (const exception &e) {
+            failCount++;
+            cerr << "FAIL " << job.imagePath << ": " << e.what() << "\n";
+            continue;
+        }
+        error_code ec;
+        uint64_t inSize = fs::file_size(job.imagePath, ec), binSize = fs::file_size(job.outputPath + ".bin", ec);
+        totalIn += inSize;
+        totalBin += binSize;
+        double fileSeconds = chrono::duration<double>(chrono::steady_clock::now() - fileStart).count();
+        printf("%s  %.1f KB -> bin %.1f KB (%.2fx)  %.3f s\n", job.imagePath.c_str(), inSize / 1024.0, binSize / 1024.0,
+               binSize ? double(inSize) / binSize : 0.0, fileSeconds);
+        statsEntries.push_back(statsEntry(job.imagePath, fileSeconds, stats));
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("%zu files, %d failed, %.1f MB in -> %.1f MB bin, %.3f s, %.1f MB peak buffers\n",
+           jobs.size(), failCount, totalIn / (1024.0 * 1024.0), totalBin / (1024.0 * 1024.0), seconds,
+           context.highWaterBytes() / (1024.0 * 1024.0));
+    bool statsWritten = writeStats(statsPath, statsEntries);
+    return (failCount > 0 || inputError || !statsWritten) ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    string outputDir = "../output/";
+    string format = "jpg";
+    string statsPath;
+    int quality = 50;
+    QualityTarget target;
+    int threads = 0;
+    bool stream = false;
+    bool force = false;
+    vector<string> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if ((arg == "-o" || arg == "--output") && hasValue) {
+            outputDir = argv[++i];
+        } else if ((arg == "-q" || arg == "--quality") && hasValue) {
+            if (!parseNumber(argv[++i], 1, 100, quality)) {
+                cerr << "Invalid quality: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if ((arg == "-j" || arg == "--threads") && hasValue) {
+            if (!parseNumber(argv[++i], 1, 1024, threads)) {
+                cerr << "Invalid thread count: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if ((arg == "-f" || arg == "--format") && hasValue) {
+            format = argv[++i];
+            if (format != "jpg" && format != "png" && format != "webp") {
+                cerr << "Unsupported format: " << format << "\n";
+                return 2;
+            }
+        } else if (arg == "--target-size" && hasValue) {
+            target.goal = QualityGoal::MaxBytes;
+            if (!parseByteSize(argv[++i], target.value)) {
+                cerr << "Invalid target size: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--min-ssim" && hasValue) {
+            target.goal = QualityGoal::MinSsim;
+            if (!parseDecimal(argv[++i], 0, 1, target.value)) {
+                cerr << "Invalid SSIM: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--min-psnr" && hasValue) {
+            target.goal = QualityGoal::MinPsnr;
+            if (!parseDecimal(argv[++i], 0, 200, target.value)) {
+                cerr << "Invalid PSNR: " << argv[i] << "\n";
+                return 2;
+            }
+        } else if (arg == "--stats" && hasValue) {
+            statsPath = argv[++i];
+        } else if (arg == "--force") {
+            force = true;
+        } else if (arg == "-s" || arg == "--stream") {
+            stream = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            cerr << "Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 2;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+
+    if (inputs.empty()) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    // Expand directories to the images directly inside them, taking a file
+    // named more than once only the first time
+    vector<fs::path> sources;
+    set<fs::path> seen;
+    bool inputError = false;
+    error_code ec;
+    fs::create_directories(outputDir, ec);
+    for (const string &input : inputs) {
+        vector<fs::path> files;
+        if (fs::is_directory(input, ec)) {
+            for (const fs::directory_entry &entry : fs::directory_iterator(input, ec)) {
+                if (entry.is_regular_file(ec) && isImageFile(entry.path())) files.push_back(entry.path());
+            }
+            sort(files.begin(), files.end());
+        } else if (fs::is_regular_file(input, ec)) {
+            files.push_back(input);
+        } else {
+            cerr << "Not found: " << input << "\n";
+            inputError = true;
+        }
+        for (const fs::path &file : files) {
+            fs::path canonical = fs::weakly_canonical(file, ec);
+            if (seen.insert(ec ? file : canonical).second) sources.push_back(file);
+        }
+    }
+    vector<BatchJob> jobs;
+    vector<string> names = outputNames(sources);
+    for (size_t i = 0; i < sources.size(); ++i) {
+        string outputPath = (fs::path(outputDir) / names[i]).string();
+        jobs.push_back({sources[i].string(), outputPath, compressionParams(format, quality), format, target});
+    }
+
+    ThreadPool pool(threads);
+    CompressionContext context(pool);
+    if (stream) return runStreaming(jobs, context, inputError, statsPath);
+    BatchCompressor compressor(threads, &context);
+    // Unchanged images from earlier runs, and repeats of one image, are not
+    // compressed again
+    OutputIndex index((fs::path(outputDir) / kOutputIndexName).string());
+    if (force) index.clear();
+    compressor.setOutputIndex(&index);
+    mutex printLock;
+    int failCount = 0, cachedCount = 0;
+    uint64_t totalIn = 0, totalBin = 0;
+    vector<string> statsEntries;
+
+    auto start = chrono::steady_clock::now();
+    compressor.run(jobs, [&](const BatchResult &result) {
+        lock_guard<mutex> guard(printLock);
+        if (!result.success) {
+            failCount++;
+            cerr << "FAIL " << result.imagePath << ": " << result.error << "\n";
+            return;
+        }
+        totalIn += result.originalSize;
+        totalBin += result.binSize;
+        if (result.cached) cachedCount++;
+        statsEntries.push_back(statsEntry(result.imagePath, result.seconds, result.stats));
+        string sideLabel = format;
+        if (target.goal != QualityGoal::Fixed && result.imageQuality >= 0) {
+            sideLabel += " q" + to_string(result.imageQuality);
+        }
+        printf("%s  %.1f KB -> bin %.1f KB (%.2fx), %s %.1f KB (%.2fx)  %.3f s%s\n",
+               result.imagePath.c_str(),
+               result.originalSize / 1024.0,
+               result.binSize / 1024.0, result.binSize ? double(result.originalSize) / result.binSize : 0.0,
+               sideLabel.c_str(),
+               result.compressedSize / 1024.0, result.compressedSize ? double(result.originalSize) / result.compressedSize : 0.0,
+               result.seconds, result.cached ? "  cached" : "");
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!index.save()) cerr << "Error writing " << index.path() << "\n";
+
+    printf("%zu files, %d failed, %d cached, %.1f MB in -> %.1f MB bin, %.3f s, %.1f MB peak buffers\n",
+           jobs.size(), failCount, cachedCount, totalIn / (1024.0 * 1024.0), totalBin / (1024.0 * 1024.0), seconds,
+           context.highWaterBytes() / (1024.0 * 1024.0));
+    bool statsWritten = writeStats(statsPath, statsEntries);
+    return (failCount > 0 || inputError || !statsWritten) ? 1 : 0;
+}
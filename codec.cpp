@@ -0,0 +1,822 @@
+#include "codec.h"
+#include "crc32c.h"
+#include "planes.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+// .bin layout, version 2, all little-endian:
+//
+//   header   64 bytes: magic, u16 version, u16 header size, width, height,
+//            channels, bits per sample, block rows, block columns, transform
+//            (colour transform in the low byte, predictor in the next),
+//            flags (bit 0: planar, bit 1: interleaved streams), block count, one byte per plane holding
+//            its table count minus one, u64 index offset, index entry size
+//            and the CRC-32C of the header (with this field zero) and tables
+//   tables   per plane, 256 canonical code lengths per table
+//   index    per block its payload offset, the CRC-32C of its payload and
+//            the valid bit count of each stream, then the index's CRC-32C
+//   payloads back to back: the row predictor bytes (one per row, with
+//            prediction on), one table selector per stream (when any plane
+//            has several tables), then the streams in plane order
+//   footer   u64 total payload size, end magic
+//
+// Everything but the payloads has a size known from the first 64 bytes, so
+// a mapped file is checked against its footer before any block is touched.
+static const char kBinMagic[4] = {'H', 'U', 'F', 'B'};
+static const char kBinEndMagic[4] = {'H', 'U', 'F', 'E'};
+static const uint16_t kBinVersion = 2;
+static const size_t kHeaderSize = 64;
+static const size_t kHeaderCrcOffset = 60;
+static const size_t kIndexCrcSize = 4;
+static const size_t kFooterSize = 12;
+static const uint32_t kBitsPerSample = 8;
+static const uint32_t kFlagPlanar = 1;
+static const uint32_t kFlagInterleaved = 2;
+
+static void putU16(uint8_t *out, uint16_t v) {
+    out[0] = uint8_t(v);
+    out[1] = uint8_t(v >> 8);
+}
+
+static void putU32(uint8_t *out, uint32_t v) {
+    out[0] = uint8_t(v);
+    out[1] = uint8_t(v >> 8);
+    out[2] = uint8_t(v >> 16);
+    out[3] = uint8_t(v >> 24);
+}
+
+static void putU64(uint8_t *out, uint64_t v) {
+    putU32(out, uint32_t(v));
+    putU32(out + 4, uint32_t(v >> 32));
+}
+
+static uint16_t getU16(const uint8_t *b) {
+    return uint16_t(b[0] | b[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t *b) {
+    return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+}
+
+static uint64_t getU64(const uint8_t *b) {
+    return uint64_t(getU32(b)) | uint64_t(getU32(b + 4)) << 32;
+}
+
+static size_t indexEntrySize(size_t planeCount) {
+    return 12 + 8 * planeCount;
+}
+
+static size_t indexEntrySize(const EncodedImage &image) {
+    return indexEntrySize(image.planeCount());
+}
+
+// Everything before the block index
+static vector<uint8_t> headerBytes(const EncodedImage &image) {
+    vector<uint8_t> out(kHeaderSize, 0);
+    memcpy(&out[0], kBinMagic, sizeof(kBinMagic));
+    putU16(&out[4], kBinVersion);
+    putU16(&out[6], kHeaderSize);
+    putU32(&out[8], image.width);
+    putU32(&out[12], image.height);
+    putU32(&out[16], image.channels);
+    putU32(&out[20], kBitsPerSample);
+    putU32(&out[24], image.blockRows);
+    putU32(&out[28], image.blockCols);
+    putU32(&out[32], uint32_t(image.transform.color) | uint32_t(image.transform.predictor) << 8);
+    putU32(&out[36], (image.planar ? kFlagPlanar : 0) | (image.interleaved ? kFlagInterleaved : 0));
+    putU32(&out[40], image.blockCount());
+    for (size_t p = 0; p < image.tables.size(); ++p) out[44 + p] = uint8_t(image.tables[p].size() - 1);
+    for (const vector<CodeLengths> &set : image.tables) {
+        for (const CodeLengths &lengths : set) out.insert(out.end(), lengths.begin(), lengths.end());
+    }
+    putU64(&out[48], out.size());
+    putU32(&out[56], indexEntrySize(image));
+    putU32(&out[kHeaderCrcOffset], crc32c(out.data(), out.size()));
+    return out;
+}
+
+static void putIndexEntry(uint8_t *out, uint64_t offset, uint32_t checksum, const EncodedBlock &block) {
+    putU64(out, offset);
+    putU32(out + 8, checksum);
+    for (size_t p = 0; p < block.streams.size(); ++p) putU64(out + 12 + 8 * p, block.streams[p].bitCount);
+}
+
+static void putFooter(uint8_t *out, uint64_t payloadBytes) {
+    putU64(out, payloadBytes);
+    memcpy(out + 8, kBinEndMagic, sizeof(kBinEndMagic));
+}
+
+// Row predictors and selectors, stored ahead of the streams
+static size_t payloadPrefixSize(const EncodedBlock &block, bool selectors) {
+    return block.rowPredictors.size() + (selectors ? block.selectors.size() : 0);
+}
+
+// CRC-32C of a block's payload as it is laid out in the file
+static uint32_t payloadChecksum(const EncodedBlock &block, bool selectors) {
+    uint32_t crc = crc32c(block.rowPredictors.data(), block.rowPredictors.size());
+    if (selectors) crc = crc32c(block.selectors.data(), block.selectors.size(), crc);
+    for (const EncodedStream &stream : block.streams) crc = crc32c(stream.bytes(), stream.byteCount(), crc);
+    return crc;
+}
+
+static size_t payloadSize(const EncodedBlock &block, bool selectors) {
+    size_t size = payloadPrefixSize(block, selectors);
+    for (const EncodedStream &stream : block.streams) size += stream.byteCount();
+    return size;
+}
+
+// The pixels of tile b, from a view whose first row is image row firstRow
+static PixelView blockView(const PixelView &pixels, const EncodedImage &image, size_t b, size_t firstRow = 0) {
+    return {pixels.row(image.blockTop(b) - firstRow) + image.blockLeft(b) * image.channels,
+            image.blockWidth(b) * image.channels, image.blockHeight(b), pixels.stride};
+}
+
+static MutablePixelView blockView(const MutablePixelView &pixels, const EncodedImage &image, size_t b) {
+    return {pixels.row(image.blockTop(b)) + image.blockLeft(b) * image.channels,
+            image.blockWidth(b) * image.channels, image.blockHeight(b), pixels.stride};
+}
+
+// Splits the rows of a block into planes stored back to back in out
+static void splitPlanes(const PixelView &block, unsigned channels, uint8_t *out) {
+    size_t width = block.rowBytes / channels, planeSize = width * block.rows;
+    for (size_t y = 0; y < block.rows; ++y) {
+        uint8_t *planes[kMaxPlanes];
+        for (unsigned c = 0; c < channels; ++c) planes[c] = out + c * planeSize + y * width;
+        deinterleave(block.row(y), width, channels, planes);
+    }
+}
+
+static void mergePlanes(const uint8_t *in, unsigned channels, const MutablePixelView &block) {
+    size_t width = block.rowBytes / channels, planeSize = width * block.rows;
+    for (size_t y = 0; y < block.rows; ++y) {
+        const uint8_t *planes[kMaxPlanes];
+        for (unsigned c = 0; c < channels; ++c) planes[c] = in + c * planeSize + y * width;
+        interleave(planes, width, channels, block.row(y));
+    }
+}
+
+// What gets coded for plane p of a tile: the prepared scratch bytes, or the
+// tile itself when there was nothing to prepare
+static PixelView codedBytes(const PixelView &tile, const EncodedImage &image, const vector<uint8_t> &scratch, size_t p) {
+    if (scratch.empty()) return tile;
+    size_t planeSize = scratch.size() / image.planeCount();
+    return bytesView(scratch.data() + p * planeSize, planeSize);
+}
+
+static Histogram sumHistograms(const vector<Histogram> &freqs) {
+    Histogram sum = {};
+    for (const Histogram &freq : freqs) {
+        for (size_t i = 0; i < sum.size(); ++i) sum[i] += freq[i];
+    }
+    return sum;
+}
+
+static vector<vector<CodeTable>> codeTables(const EncodedImage &image) {
+    vector<vector<CodeTable>> codes(image.tables.size());
+    for (size_t p = 0; p < image.tables.size(); ++p) {
+        for (const CodeLengths &lengths : image.tables[p]) codes[p].push_back(canonicalCodes(lengths));
+    }
+    return codes;
+}
+
+// Validates the options and fills in everything but tables and blocks
+static EncodedImage imageLayout(uint32_t width, uint32_t height, uint32_t channels, const EncodeOptions &options) {
+    if (options.blockRows == 0 || options.blockCols == 0) {
+        throw invalid_argument("Block size must be positive!");
+    }
+    if (channels == 0 || channels > kMaxPlanes) {
+        throw invalid_argument("Unsupported channel count!");
+    }
+    EncodedImage image;
+    image.width = width;
+    image.height = height;
+    image.channels = channels;
+    image.blockRows = options.blockRows;
+    image.blockCols = options.blockCols;
+    image.transform = options.transform;
+    if (channels < 3) image.transform.color = ColorTransform::None;
+    image.planar = options.planar && channels > 1;
+    size_t streamBytes = size_t(image.blockRows) * image.blockCols * (image.planar ? 1 : channels);
+    image.interleaved = options.interleaved && fitsInterleaved(streamBytes);
+    return image;
+}
+
+static void encodeStream(const PixelView &bytes, const EncodedImage &image, const CodeTable &codes,
+                         BufferPool *buffers, EncodedStream &stream) {
+    stream.data = acquireBuffer(buffers, bytes.size() + kJumpTableSize + 8 * kSubstreams);
+    if (image.interleaved) {
+        encodeInterleaved(bytes, codes, stream.data, stream.bitCount);
+    } else {
+        encode(bytes, codes, stream.data, stream.bitCount);
+    }
+}
+
+// Hands every byte vector of block back to buffers
+static void releaseBlock(EncodedBlock &block, BufferPool *buffers) {
+    for (EncodedStream &stream : block.streams) releaseBuffer(buffers, stream.data);
+    releaseBuffer(buffers, block.rowPredictors);
+    releaseBuffer(buffers, block.selectors);
+}
+
+// Transforms a tile and splits it into planes, leaving the bytes to code in
+// scratch plane after plane, and histograms plane p into freqs[p * freqStride]. scratch
+// stays empty when the tile is coded straight from the pixels; otherwise it
+// comes from buffers and goes back there once the tile is coded. block's
+// row predictors and selectors come from buffers too.
+static void prepareBlock(const PixelView &tile, const EncodedImage &image, EncodedBlock &block,
+                         vector<uint8_t> &scratch, Histogram *freqs, size_t freqStride, CompressionStats *stats,
+                         BufferPool *buffers) {
+    PixelView source = tile;
+    {
+        ScopedTimer timer(stats, Stage::Extract);
+        if (image.transform.enabled()) {
+            bool predicted = image.transform.predictor != Predictor::None;
+            scratch = acquireBuffer(buffers, tile.size());
+            scratch.resize(tile.size());
+            if (predicted) {
+                block.rowPredictors = acquireBuffer(buffers, tile.rows);
+                block.rowPredictors.resize(tile.rows);
+            }
+            forwardTransform(tile, image.channels, image.transform, scratch.data(),
+                             predicted ? block.rowPredictors.data() : nullptr);
+            source = {scratch.data(), tile.rowBytes, tile.rows, tile.rowBytes};
+        }
+        if (image.planar) {
+            vector<uint8_t> planes = acquireBuffer(buffers, tile.size());
+            planes.resize(tile.size());
+            splitPlanes(source, image.channels, planes.data());
+            scratch.swap(planes);
+            releaseBuffer(buffers, planes);
+        }
+    }
+    ScopedTimer timer(stats, Stage::Histogram);
+    for (size_t p = 0; p < image.planeCount(); ++p) {
+        countFrequencies(codedBytes(tile, image, scratch, p), freqs[p * freqStride]);
+    }
+    block.streams.resize(image.planeCount());
+    block.selectors = acquireBuffer(buffers, image.planeCount());
+    block.selectors.assign(image.planeCount(), 0);
+}
+
+// Shared by both encodeImage() overloads. image receives the tables; onTables
+// runs once they are known and onBlock once per finished block, from
+// whichever pool thread completed it.
+static void encodeBlocks(const PixelView &pixels, ThreadPool &pool, const EncodeOptions &options, EncodedImage &image,
+                         const function<void()> &onTables, const function<void(size_t, EncodedBlock &)> &onBlock) {
+    size_t blockCount = image.blockCount(), planeCount = image.planeCount();
+    vector<EncodedBlock> blocks(blockCount);
+
+    // Transform, split and histogram each tile in parallel
+    vector<vector<uint8_t>> scratch(blockCount);
+    vector<Histogram> blockFreq = acquireHistograms(options.buffers, blockCount * planeCount);  // [plane][tile]
+    pool.parallelFor(blockCount, [&](size_t b) {
+        prepareBlock(blockView(pixels, image, b), image, blocks[b], scratch[b], &blockFreq[b], blockCount,
+                     options.stats, options.buffers);
+    });
+    if (options.stats) options.stats->addSymbols(sumHistograms(blockFreq));
+
+    // Cluster the tiles of each plane onto a few tables, planes in parallel
+    image.tables.resize(planeCount);
+    vector<vector<uint8_t>> selectors(planeCount);
+    pool.parallelFor(planeCount, [&](size_t p) {
+        ScopedTimer timer(options.stats, Stage::TreeBuild);
+        selectors[p] = acquireBuffer(options.buffers, blockCount);
+        image.tables[p] = buildCodeTableSet(&blockFreq[p * blockCount], blockCount, options.maxTables, selectors[p]);
+    });
+    releaseHistograms(options.buffers, blockFreq);
+    vector<vector<CodeTable>> codes;
+    {
+        ScopedTimer timer(options.stats, Stage::TreeBuild);
+        codes = codeTables(image);
+    }
+    onTables();
+
+    // Every (tile, plane) stream is coded as its own task; the last plane of
+    // a tile to finish hands the tile on and frees its scratch
+    vector<atomic<unsigned>> remaining(blockCount);
+    for (size_t b = 0; b < blockCount; ++b) {
+        for (size_t p = 0; p < planeCount; ++p) blocks[b].selectors[p] = selectors[p][b];
+        remaining[b] = unsigned(planeCount);
+    }
+    for (vector<uint8_t> &set : selectors) releaseBuffer(options.buffers, set);
+    pool.parallelFor(blockCount * planeCount, [&](size_t task) {
+        size_t b = task / planeCount, p = task % planeCount;
+        EncodedStream &stream = blocks[b].streams[p];
+        {
+            ScopedTimer timer(options.stats, Stage::Encode);
+            encodeStream(codedBytes(blockView(pixels, image, b), image, scratch[b], p), image,
+                         codes[p][blocks[b].selectors[p]], options.buffers, stream);
+        }
+        if (options.stats) options.stats->addCodedBits(stream.bitCount);
+        if (--remaining[b] == 0) {
+            releaseBuffer(options.buffers, scratch[b]);
+            onBlock(b, blocks[b]);
+            // Whatever onBlock left behind (all of it, for a writer) is done with
+            releaseBlock(blocks[b], options.buffers);
+        }
+    });
+}
+
+EncodedImage encodeImage(const PixelView &pixels, uint32_t width, uint32_t channels, ThreadPool &pool,
+                         const EncodeOptions &options) {
+    EncodedImage image = imageLayout(width, pixels.rows, channels, options);
+    encodeBlocks(pixels, pool, options, image, [&] { image.blocks.resize(image.blockCount()); },
+                 [&](size_t b, EncodedBlock &block) { image.blocks[b] = move(block); });
+    return image;
+}
+
+void encodeImage(const PixelView &pixels, uint32_t width, uint32_t channels, ThreadPool &pool,
+                 EncodedImageWriter &writer, const EncodeOptions &options) {
+    EncodedImage image = imageLayout(width, pixels.rows, channels, options);
+    encodeBlocks(pixels, pool, options, image, [&] { writer.begin(image); },
+                 [&](size_t b, EncodedBlock &block) { writer.writeBlock(b, move(block)); });
+}
+
+// Pass one of encodeStrips() histograms at most about this many tiles
+static const size_t kMaxSampleTiles = 1024;
+
+void encodeStrips(uint32_t width, uint32_t height, uint32_t channels, const RowSource &readRows, ThreadPool &pool,
+                  EncodedImageWriter &writer, const EncodeOptions &options) {
+    EncodedImage image = imageLayout(width, height, channels, options);
+    size_t across = image.blocksAcross(), stripCount = image.blocksDown(), planeCount = image.planeCount();
+    vector<uint8_t> buffer(image.rowBytes() * image.blockRows);
+    auto readStrip = [&](size_t s) {
+        size_t first = s * image.blockRows, rows = min<size_t>(image.blockRows, height - first);
+        ScopedTimer timer(options.stats, Stage::Read);
+        readRows(first, rows, buffer.data());
+        return PixelView{buffer.data(), image.rowBytes(), rows, image.rowBytes()};
+    };
+
+    // Pass 1: histogram the tiles of evenly spaced strips and cluster them
+    // into tables
+    size_t sampleStrips = min(stripCount, max<size_t>(1, kMaxSampleTiles / across));
+    size_t step = (stripCount + sampleStrips - 1) / sampleStrips;
+    size_t samples = (stripCount + step - 1) / step * across;
+    vector<Histogram> sampleFreq = acquireHistograms(options.buffers, samples * planeCount);  // [tile][plane]
+    for (size_t s = 0, base = 0; s < stripCount; s += step, base += across * planeCount) {
+        PixelView strip = readStrip(s);
+        pool.parallelFor(across, [&](size_t x) {
+            EncodedBlock block;
+            vector<uint8_t> scratch;
+            prepareBlock(blockView(strip, image, s * across + x, s * image.blockRows), image, block, scratch,
+                         &sampleFreq[base + x * planeCount], 1, options.stats, options.buffers);
+            releaseBuffer(options.buffers, scratch);
+            releaseBlock(block, options.buffers);
+        });
+    }
+    image.tables.resize(planeCount);
+    pool.parallelFor(planeCount, [&](size_t p) {
+        ScopedTimer timer(options.stats, Stage::TreeBuild);
+        vector<Histogram> planeFreq = acquireHistograms(options.buffers, samples);
+        for (size_t i = 0; i < samples; ++i) planeFreq[i] = sampleFreq[i * planeCount + p];
+        vector<uint8_t> selectors = acquireBuffer(options.buffers, samples);
+        image.tables[p] = buildCodeTableSet(planeFreq.data(), samples, options.maxTables, selectors);
+        // Unsampled tiles may hold symbols the samples lack, so every table
+        // gets a code for all 256 byte values
+        for (size_t t = 0; t < image.tables[p].size(); ++t) {
+            Histogram sum = {};
+            for (size_t i = 0; i < samples; ++i) {
+                if (selectors[i] != t) continue;
+                for (unsigned sym = 0; sym < 256; ++sym) sum[sym] += planeFreq[i][sym];
+            }
+            for (uint64_t &n : sum) n = max<uint64_t>(n, 1);
+            image.tables[p][t] = buildCodeLengths(sum);
+        }
+        releaseHistograms(options.buffers, planeFreq);
+        releaseBuffer(options.buffers, selectors);
+    });
+    releaseHistograms(options.buffers, sampleFreq);
+    vector<vector<CodeTable>> codes;
+    {
+        ScopedTimer timer(options.stats, Stage::TreeBuild);
+        codes = codeTables(image);
+    }
+    writer.begin(image);
+
+    // Pass 2: code each strip's tiles in parallel, each with its cheapest table
+    for (size_t s = 0; s < stripCount; ++s) {
+        PixelView strip = readStrip(s);
+        pool.parallelFor(across, [&](size_t x) {
+            size_t b = s * across + x;
+            PixelView tile = blockView(strip, image, b, s * image.blockRows);
+            EncodedBlock block;
+            vector<uint8_t> scratch;
+            Histogram freqs[kMaxPlanes];
+            prepareBlock(tile, image, block, scratch, freqs, 1, options.stats, options.buffers);
+            {
+                ScopedTimer timer(options.stats, Stage::Encode);
+                for (size_t p = 0; p < planeCount; ++p) {
+                    uint64_t best = UINT64_MAX;
+                    for (size_t t = 0; t < image.tables[p].size(); ++t) {
+                        uint64_t bits = codedBits(freqs[p], image.tables[p][t]);
+                        if (bits < best) {
+                            best = bits;
+                            block.selectors[p] = uint8_t(t);
+                        }
+                    }
+                    EncodedStream &stream = block.streams[p];
+                    encodeStream(codedBytes(tile, image, scratch, p), image, codes[p][block.selectors[p]],
+                                 options.buffers, stream);
+                    if (options.stats) {
+                        options.stats->addSymbols(freqs[p]);
+                        options.stats->addCodedBits(stream.bitCount);
+                    }
+                }
+            }
+            releaseBuffer(options.buffers, scratch);
+            writer.writeBlock(b, move(block));
+            releaseBlock(block, options.buffers);
+        });
+    }
+}
+
+static DecoderSet makeDecoders(const EncodedImage &image, BufferPool *buffers = nullptr) {
+    DecoderSet decoders(image.tables.size());
+    for (size_t p = 0; p < image.tables.size(); ++p) {
+        for (const CodeLengths &lengths : image.tables[p]) decoders[p].emplace_back(lengths, buffers);
+    }
+    return decoders;
+}
+
+static void releaseDecoders(DecoderSet &decoders, BufferPool *buffers) {
+    for (vector<HuffmanDecoder> &set : decoders) {
+        for (HuffmanDecoder &decoder : set) decoder.releaseTable(buffers);
+    }
+}
+
+static void decodeBlock(const EncodedImage &image, const DecoderSet &decoders, const EncodedBlock &block,
+                        const MutablePixelView &target, ThreadPool &pool, BufferPool *buffers = nullptr) {
+    if (image.planar) {
+        // Planes decode side by side into scratch, then interleave
+        vector<uint8_t> planes = acquireBuffer(buffers, target.size());
+        planes.resize(target.size());
+        size_t planeSize = target.size() / image.channels;
+        pool.parallelFor(image.channels, [&](size_t p) {
+            const EncodedStream &stream = block.streams[p];
+            const HuffmanDecoder &decoder = decoders[p][block.selectors[p]];
+            if (image.interleaved) {
+                decoder.decodeInterleaved(stream.bytes(), stream.byteCount(), planes.data() + p * planeSize, planeSize);
+            } else {
+                BitReader reader(stream.bytes(), stream.byteCount());
+                decoder.decode(reader, planes.data() + p * planeSize, planeSize);
+            }
+        });
+        mergePlanes(planes.data(), image.channels, target);
+        releaseBuffer(buffers, planes);
+    } else {
+        const EncodedStream &stream = block.streams[0];
+        const HuffmanDecoder &decoder = decoders[0][block.selectors[0]];
+        if (image.interleaved) {
+            decoder.decodeInterleaved(stream.bytes(), stream.byteCount(), target);
+        } else {
+            BitReader reader(stream.bytes(), stream.byteCount());
+            decoder.decode(reader, target);
+        }
+    }
+    if (image.transform.enabled()) {
+        inverseTransform(target, image.channels, image.transform.color,
+                         block.rowPredictors.empty() ? nullptr : block.rowPredictors.data());
+    }
+}
+
+void decodeImage(const EncodedImage &image, const MutablePixelView &out, ThreadPool &pool, BufferPool *buffers) {
+    if (out.rows != image.height || out.rowBytes != image.rowBytes()) {
+        throw invalid_argument("Decode target does not match the image size!");
+    }
+    DecoderSet decoders = makeDecoders(image, buffers);
+    pool.parallelFor(image.blocks.size(), [&](size_t b) {
+        decodeBlock(image, decoders, image.blocks[b], blockView(out, image, b), pool, buffers);
+    });
+    releaseDecoders(decoders, buffers);
+}
+
+void decodeRegion(const EncodedImageReader &reader, size_t x, size_t y, const MutablePixelView &out, ThreadPool &pool) {
+    const EncodedImage &image = reader.header();
+    size_t width = out.rowBytes / image.channels;
+    if (out.rowBytes % image.channels != 0 || x + width > image.width || y + out.rows > image.height) {
+        throw invalid_argument("Region outside the image!");
+    }
+    if (width == 0 || out.rows == 0) return;
+
+    // Only the tiles the region overlaps are read and decoded
+    size_t firstCol = x / image.blockCols, lastCol = (x + width - 1) / image.blockCols;
+    size_t firstRow = y / image.blockRows, lastRow = (y + out.rows - 1) / image.blockRows;
+    size_t cols = lastCol - firstCol + 1;
+    const DecoderSet &decoders = reader.decoders();
+    pool.parallelFor(cols * (lastRow - firstRow + 1), [&](size_t i) {
+        size_t b = (firstRow + i / cols) * image.blocksAcross() + firstCol + i % cols;
+        EncodedBlock block = reader.readBlock(b);
+        size_t tileWidth = image.blockWidth(b), tileHeight = image.blockHeight(b);
+        vector<uint8_t> tile(tileWidth * tileHeight * image.channels);
+        MutablePixelView target{tile.data(), tileWidth * image.channels, tileHeight, tileWidth * image.channels};
+        decodeBlock(image, decoders, block, target, pool);
+
+        // Copy the overlap into the region
+        size_t left = max(x, image.blockLeft(b)), right = min(x + width, image.blockLeft(b) + tileWidth);
+        size_t top = max(y, image.blockTop(b)), bottom = min(y + out.rows, image.blockTop(b) + tileHeight);
+        for (size_t row = top; row < bottom; ++row) {
+            memcpy(out.row(row - y) + (left - x) * image.channels,
+                   target.row(row - image.blockTop(b)) + (left - image.blockLeft(b)) * image.channels,
+                   (right - left) * image.channels);
+        }
+    });
+}
+
+EncodedImageWriter::EncodedImageWriter(const string &path, CompressionStats *stats, BufferPool *buffers)
+    : file(path), stats(stats), buffers(buffers), nextBlock(0), draining(false), selectors(false), indexOffset(0), payloadOffset(0), entrySize(0) {}
+
+void EncodedImageWriter::begin(const EncodedImage &image) {
+    ScopedTimer timer(stats, Stage::FileWrite);
+    vector<uint8_t> header = headerBytes(image);
+    file.append(header.data(), header.size());
+    selectors = image.hasSelectors();
+    entrySize = indexEntrySize(image);
+    // Placeholder for the index and its checksum, filled in by finish()
+    index.assign(image.blockCount() * entrySize + kIndexCrcSize, 0);
+    indexOffset = file.size();
+    file.append(index.data(), index.size());
+}
+
+void EncodedImageWriter::writePayload(size_t b, const EncodedBlock &block, uint32_t checksum) {
+    ScopedTimer timer(stats, Stage::FileWrite);
+    putIndexEntry(&index[b * entrySize], payloadOffset, checksum, block);
+    file.append(block.rowPredictors.data(), block.rowPredictors.size());
+    if (selectors) file.append(block.selectors.data(), block.selectors.size());
+    for (const EncodedStream &stream : block.streams) file.append(stream.bytes(), stream.byteCount());
+    payloadOffset += payloadSize(block, selectors);
+}
+
+void EncodedImageWriter::writeBlock(size_t b, const EncodedBlock &block) {
+    submit(b, block, nullptr);
+}
+
+void EncodedImageWriter::writeBlock(size_t b, EncodedBlock &&block) {
+    submit(b, block, &block);
+}
+
+void EncodedImageWriter::submit(size_t b, const EncodedBlock &block, EncodedBlock *owned) {
+    if (entrySize == 0 || b >= index.size() / entrySize) {
+        throw invalid_argument("Block index out of range!");
+    }
+    // Checksums are taken on the calling thread, before the blocks serialise
+    uint32_t checksum = payloadChecksum(block, selectors);
+    unique_lock<mutex> guard(lock);
+    // Only one thread writes at a time; anything that can't go out right
+    // now waits in pending for the thread that is draining
+    if (b != nextBlock || draining) {
+        if (owned) {
+            pending.emplace(b, make_pair(checksum, move(*owned)));
+        } else {
+            pending.emplace(b, make_pair(checksum, block));
+        }
+        return;
+    }
+    draining = true;
+    guard.unlock();
+    writePayload(b, block, checksum);
+    guard.lock();
+    for (;;) {
+        nextBlock++;
+        auto next = pending.find(nextBlock);
+        if (next == pending.end()) break;
+        pair<uint32_t, EncodedBlock> ready = move(next->second);
+        pending.erase(next);
+        guard.unlock();
+        writePayload(nextBlock, ready.second, ready.first);
+        releaseBlock(ready.second, buffers);
+        guard.lock();
+    }
+    draining = false;
+}
+
+uint64_t EncodedImageWriter::finish() {
+    if (entrySize == 0 || nextBlock != index.size() / entrySize) {
+        throw logic_error("Not all blocks were written!");
+    }
+    ScopedTimer timer(stats, Stage::FileWrite);
+    putU32(&index[index.size() - kIndexCrcSize], crc32c(index.data(), index.size() - kIndexCrcSize));
+    file.writeAt(indexOffset, index.data(), index.size());
+    uint8_t footer[kFooterSize];
+    putFooter(footer, payloadOffset);
+    file.append(footer, sizeof(footer));
+    uint64_t size = file.size();
+    file.close();
+    return size;
+}
+
+// Byte source for the .bin parser. Stream payloads are referenced in place
+// rather than copied.
+namespace {
+
+struct MemorySource {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+
+    bool read(void *out, size_t n) {
+        // Empty vectors hand in a null out
+        if (n == 0) return true;
+        if (n > size - pos) return false;
+        memcpy(out, data + pos, n);
+        pos += n;
+        return true;
+    }
+    bool payload(EncodedStream &stream) {
+        size_t n = stream.byteCount();
+        if (stream.bitCount > uint64_t(size - pos) * 8) return false;
+        stream.mapped = data + pos;
+        pos += n;
+        return true;
+    }
+};
+
+}
+
+// Header, tables and block index. Blocks come back with their stream bit
+// counts set; offsets receives each payload's offset from the end of the
+// index and checksums each payload's CRC.
+template <class Source>
+static EncodedImage parseHeader(Source &src, vector<uint64_t> &offsets, vector<uint32_t> &checksums) {
+    vector<uint8_t> header(kHeaderSize);
+    if (!src.read(header.data(), header.size())) {
+        throw runtime_error("Truncated compressed file!");
+    }
+    if (memcmp(&header[0], kBinMagic, sizeof(kBinMagic)) != 0) {
+        throw runtime_error("Invalid compressed file header!");
+    }
+    if (getU16(&header[4]) != kBinVersion || getU16(&header[6]) != kHeaderSize) {
+        throw runtime_error("Unsupported compressed file version!");
+    }
+    EncodedImage image;
+    image.width = getU32(&header[8]);
+    image.height = getU32(&header[12]);
+    image.channels = getU32(&header[16]);
+    uint32_t depth = getU32(&header[20]);
+    image.blockRows = getU32(&header[24]);
+    image.blockCols = getU32(&header[28]);
+    uint32_t transform = getU32(&header[32]);
+    image.transform.color = ColorTransform(transform & 0xff);
+    image.transform.predictor = Predictor((transform >> 8) & 0xff);
+    uint32_t flags = getU32(&header[36]);
+    image.planar = (flags & kFlagPlanar) != 0;
+    image.interleaved = (flags & kFlagInterleaved) != 0;
+    uint32_t blockCount = getU32(&header[40]);
+    uint64_t indexOffset = getU64(&header[48]);
+    uint32_t entrySize = getU32(&header[56]);
+    uint32_t headerChecksum = getU32(&header[kHeaderCrcOffset]);
+    if (image.width == 0 || image.height == 0 || image.channels == 0 || image.channels > kMaxPlanes ||
+        depth != kBitsPerSample || image.blockRows == 0 || image.blockCols == 0 || blockCount != image.blockCount() ||
+        (transform >> 16) != 0 || uint8_t(image.transform.color) > uint8_t(ColorTransform::YCoCgR) ||
+        (image.transform.predictor != Predictor::Adaptive && uint8_t(image.transform.predictor) >= kPredictorCount) ||
+        (flags & ~(kFlagPlanar | kFlagInterleaved)) != 0 || entrySize != indexEntrySize(image)) {
+        throw runtime_error("Invalid compressed file header!");
+    }
+
+    image.tables.resize(image.planeCount());
+    for (size_t p = 0; p < image.tables.size(); ++p) {
+        image.tables[p].resize(header[44 + p] + 1);
+        for (CodeLengths &lengths : image.tables[p]) {
+            size_t pos = header.size();
+            header.resize(pos + lengths.size());
+            if (!src.read(&header[pos], lengths.size())) {
+                throw runtime_error("Truncated compressed file!");
+            }
+            copy(header.begin() + pos, header.end(), lengths.begin());
+        }
+    }
+    putU32(&header[kHeaderCrcOffset], 0);
+    if (indexOffset != header.size() || crc32c(header.data(), header.size()) != headerChecksum) {
+        throw runtime_error("Invalid compressed file header!");
+    }
+
+    // The index is checked before any bit count in it is trusted
+    vector<uint8_t> index(size_t(blockCount) * entrySize + kIndexCrcSize);
+    if (!src.read(index.data(), index.size())) {
+        throw runtime_error("Truncated compressed file!");
+    }
+    if (crc32c(index.data(), index.size() - kIndexCrcSize) != getU32(&index[index.size() - kIndexCrcSize])) {
+        throw runtime_error("Compressed file checksum mismatch!");
+    }
+    offsets.resize(blockCount);
+    checksums.resize(blockCount);
+    image.blocks.resize(blockCount);
+    for (uint32_t b = 0; b < blockCount; ++b) {
+        const uint8_t *entry = &index[size_t(b) * entrySize];
+        offsets[b] = getU64(entry);
+        checksums[b] = getU32(entry + 8);
+        image.blocks[b].streams.resize(image.planeCount());
+        for (size_t p = 0; p < image.planeCount(); ++p) image.blocks[b].streams[p].bitCount = getU64(entry + 12 + 8 * p);
+    }
+    return image;
+}
+
+// Returns the total payload size recorded in the footer
+static uint64_t parseFooter(const uint8_t *bytes) {
+    if (memcmp(bytes + 8, kBinEndMagic, sizeof(kBinEndMagic)) != 0) {
+        throw runtime_error("Truncated compressed file!");
+    }
+    return getU64(bytes);
+}
+
+// Checks from the fixed header and footer alone that a file in memory is
+// complete, before anything else is parsed
+static void checkMappedSize(const uint8_t *data, size_t size) {
+    if (size < kHeaderSize + kFooterSize) {
+        throw runtime_error("Truncated compressed file!");
+    }
+    uint64_t payloadBytes = parseFooter(data + size - kFooterSize);
+    uint64_t indexOffset = getU64(data + 48), entrySize = getU32(data + 56), blockCount = getU32(data + 40);
+    if (indexOffset > size || payloadBytes > size || entrySize > indexEntrySize(kMaxPlanes) ||
+        indexOffset + blockCount * entrySize + kIndexCrcSize + payloadBytes + kFooterSize != size) {
+        throw runtime_error("Truncated compressed file!");
+    }
+}
+
+// Reads the payload of block b, whose stream bit counts are already set, and
+// checks it against its CRC before anything looks inside it
+template <class Source>
+static void parseBlock(Source &src, const EncodedImage &image, size_t b, uint32_t checksum, EncodedBlock &block) {
+    block.rowPredictors.resize(image.transform.predictor != Predictor::None ? image.blockHeight(b) : 0);
+    block.selectors.assign(image.planeCount(), 0);
+    if (!src.read(block.rowPredictors.data(), block.rowPredictors.size()) ||
+        (image.hasSelectors() && !src.read(block.selectors.data(), block.selectors.size()))) {
+        throw runtime_error("Truncated compressed file!");
+    }
+    for (EncodedStream &stream : block.streams) {
+        if (!src.payload(stream)) {
+            throw runtime_error("Truncated compressed file!");
+        }
+    }
+    if (payloadChecksum(block, image.hasSelectors()) != checksum) {
+        throw runtime_error("Compressed file checksum mismatch!");
+    }
+    for (size_t p = 0; p < image.planeCount(); ++p) {
+        if (block.selectors[p] >= image.tables[p].size()) {
+            throw runtime_error("Invalid compressed file block index!");
+        }
+    }
+}
+
+template <class Source>
+static EncodedImage parseEncodedImage(Source &src) {
+    vector<uint64_t> offsets;
+    vector<uint32_t> checksums;
+    EncodedImage image = parseHeader(src, offsets, checksums);
+    // Payloads are stored back to back in block order
+    bool selectors = image.hasSelectors();
+    uint64_t expected = 0;
+    for (size_t b = 0; b < image.blocks.size(); ++b) {
+        if (offsets[b] != expected) {
+            throw runtime_error("Invalid compressed file block index!");
+        }
+        parseBlock(src, image, b, checksums[b], image.blocks[b]);
+        expected += payloadSize(image.blocks[b], selectors);
+    }
+    uint8_t bytes[kFooterSize];
+    if (!src.read(bytes, sizeof(bytes))) {
+        throw runtime_error("Truncated compressed file!");
+    }
+    if (parseFooter(bytes) != expected) {
+        throw runtime_error("Invalid compressed file block index!");
+    }
+    return image;
+}
+
+EncodedImage readEncodedImage(const uint8_t *data, size_t size) {
+    checkMappedSize(data, size);
+    MemorySource src{data, size, 0};
+    return parseEncodedImage(src);
+}
+
+EncodedImageReader::EncodedImageReader(const string &path) : file(path, MappedFile::Access::Random) {
+    checkMappedSize(file.data(), file.size());
+    MemorySource src{file.data(), file.size(), 0};
+    image = parseHeader(src, offsets, checksums);
+    payloadStart = src.pos;
+    streamBits.resize(image.blocks.size());
+    for (size_t b = 0; b < image.blocks.size(); ++b) {
+        for (const EncodedStream &stream : image.blocks[b].streams) streamBits[b].push_back(stream.bitCount);
+    }
+    image.blocks.clear();
+    tableDecoders = makeDecoders(image);
+}
+
+EncodedBlock EncodedImageReader::readBlock(size_t b) const {
+    if (b >= offsets.size()) {
+        throw invalid_argument("Block index out of range!");
+    }
+    if (offsets[b] > file.size() - payloadStart) {
+        throw runtime_error("Invalid compressed file block index!");
+    }
+    MemorySource src{file.data(), file.size(), size_t(payloadStart + offsets[b])};
+    EncodedBlock block;
+    block.streams.resize(streamBits[b].size());
+    for (size_t p = 0; p < streamBits[b].size(); ++p) block.streams[p].bitCount = streamBits[b][p];
+    parseBlock(src, image, b, checksums[b], block);
+    return block;
+}
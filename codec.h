@@ -0,0 +1,178 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include "bufferpool.h"
+#include "fileio.h"
+#include "huffman.h"
+#include "metrics.h"
+#include "pixelview.h"
+#include "threadpool.h"
+#include "transform.h"
+
+using namespace std;
+
+// Size in pixels of the independently decodable tiles
+const unsigned kDefaultBlockRows = 64;
+const unsigned kDefaultBlockCols = 128;
+
+// Code tables per plane the encoder may choose between tile by tile
+const unsigned kDefaultMaxTables = 4;
+
+struct EncodeOptions {
+    unsigned blockRows = kDefaultBlockRows;
+    unsigned blockCols = kDefaultBlockCols;
+    TransformOptions transform;
+    bool planar = true;  // One code table set and substream per channel
+    unsigned maxTables = kDefaultMaxTables;
+    bool interleaved = true;  // Four substreams per stream, when the tiles are small enough
+    CompressionStats *stats = nullptr;  // Stage timings and coding counters, if wanted
+    BufferPool *buffers = nullptr;      // Source of tile scratch, streams and histograms, if shared
+};
+
+// A Huffman coded byte sequence starting on a byte boundary. Streams read
+// from a mapped file point into it instead of owning a copy.
+struct EncodedStream {
+    uint64_t bitCount;
+    vector<uint8_t> data;
+    const uint8_t *mapped = nullptr;
+
+    const uint8_t *bytes() const { return mapped ? mapped : data.data(); }
+    size_t byteCount() const { return size_t((bitCount + 7) / 8); }
+};
+
+// One tile, coded on its own. Planar images hold one stream per channel,
+// otherwise a single stream of interleaved bytes.
+struct EncodedBlock {
+    vector<uint8_t> rowPredictors;  // One per row, empty without prediction
+    vector<uint8_t> selectors;      // Table used by each stream
+    vector<EncodedStream> streams;
+};
+
+// An image coded as tiles in row-major order. Each plane has a small set of
+// canonical code tables shared by all tiles; a tile picks one per stream.
+struct EncodedImage {
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t blockRows;
+    uint32_t blockCols;
+    TransformOptions transform;
+    bool planar;
+    bool interleaved;  // Streams use the encodeInterleaved() layout
+    vector<vector<CodeLengths>> tables;  // [plane][table]
+    vector<EncodedBlock> blocks;
+
+    size_t planeCount() const { return planar ? channels : 1; }
+    size_t rowBytes() const { return size_t(width) * channels; }
+    size_t blocksAcross() const { return (width + blockCols - 1) / blockCols; }
+    size_t blocksDown() const { return (height + blockRows - 1) / blockRows; }
+    size_t blockCount() const { return blocksAcross() * blocksDown(); }
+    size_t blockTop(size_t b) const { return b / blocksAcross() * blockRows; }
+    size_t blockLeft(size_t b) const { return b % blocksAcross() * blockCols; }
+    size_t blockHeight(size_t b) const { return min<size_t>(blockRows, height - blockTop(b)); }
+    size_t blockWidth(size_t b) const { return min<size_t>(blockCols, width - blockLeft(b)); }
+    bool hasSelectors() const {
+        return any_of(tables.begin(), tables.end(), [](const vector<CodeLengths> &set) { return set.size() > 1; });
+    }
+};
+
+// Writes a .bin as it is produced: the header first, then each block
+// payload once it and every block before it are complete, and finally the
+// block index into space reserved after the header. Blocks may arrive from
+// any thread in any order; only out-of-order ones are held in memory.
+class EncodedImageWriter {
+public:
+    // File writes are timed into stats when it is given. Blocks held back
+    // for ordering return their stream buffers to buffers once written.
+    explicit EncodedImageWriter(const string &path, CompressionStats *stats = nullptr, BufferPool *buffers = nullptr);
+
+    // Everything but image.blocks is written here
+    void begin(const EncodedImage &image);
+    void writeBlock(size_t index, const EncodedBlock &block);
+    // Moves block in if it has to wait, else leaves it untouched
+    void writeBlock(size_t index, EncodedBlock &&block);
+    // Returns the file size
+    uint64_t finish();
+
+private:
+    void submit(size_t index, const EncodedBlock &block, EncodedBlock *owned);
+    void writePayload(size_t index, const EncodedBlock &block, uint32_t checksum);
+
+    BatchedFile file;
+    CompressionStats *stats;
+    BufferPool *buffers;
+    mutex lock;
+    map<size_t, pair<uint32_t, EncodedBlock>> pending;  // Checksum and block
+    size_t nextBlock;
+    bool draining;
+    bool selectors;
+    uint64_t indexOffset;
+    uint64_t payloadOffset;
+    vector<uint8_t> index;
+    size_t entrySize;
+};
+
+EncodedImage encodeImage(const PixelView &pixels, uint32_t width, uint32_t channels, ThreadPool &pool,
+                         const EncodeOptions &options = EncodeOptions());
+// Hands each block to writer as soon as it is coded instead of keeping the
+// whole encoded image in memory
+void encodeImage(const PixelView &pixels, uint32_t width, uint32_t channels, ThreadPool &pool,
+                 EncodedImageWriter &writer, const EncodeOptions &options = EncodeOptions());
+
+// Fills out with image rows [firstRow, firstRow + rowCount), tightly packed
+typedef function<void(size_t firstRow, size_t rowCount, uint8_t *out)> RowSource;
+
+// Encodes an image that need not fit in memory, one strip of blockRows rows
+// at a time. A first pass histograms a sample of strips to build the tables,
+// a second codes every strip, so memory use is bounded by one strip.
+void encodeStrips(uint32_t width, uint32_t height, uint32_t channels, const RowSource &readRows, ThreadPool &pool,
+                  EncodedImageWriter &writer, const EncodeOptions &options = EncodeOptions());
+
+// Decoder tables and plane scratch come from buffers when it is given
+void decodeImage(const EncodedImage &image, const MutablePixelView &out, ThreadPool &pool,
+                 BufferPool *buffers = nullptr);
+
+typedef vector<vector<HuffmanDecoder>> DecoderSet;  // [plane][table]
+
+// Random access to a .bin on disk. The file is memory mapped and only the
+// header and block index are parsed up front; a block's payload is touched
+// only when that block is read. Keep one reader per file to decode many
+// regions of it, since its decoder tables are built once.
+class EncodedImageReader {
+public:
+    explicit EncodedImageReader(const string &path);
+
+    // Layout and tables; blocks is left empty
+    const EncodedImage &header() const { return image; }
+    const DecoderSet &decoders() const { return tableDecoders; }
+    // The streams point into the mapping and stay valid while the reader
+    // lives. Throws if the block fails its checksum.
+    EncodedBlock readBlock(size_t index) const;
+
+private:
+    MappedFile file;
+    EncodedImage image;
+    DecoderSet tableDecoders;
+    vector<uint64_t> offsets;
+    vector<uint32_t> checksums;
+    vector<vector<uint64_t>> streamBits;
+    size_t payloadStart;
+};
+
+// Decodes the region whose top-left pixel is (x, y) and whose size is that
+// of out, reading only the tiles it overlaps
+void decodeRegion(const EncodedImageReader &reader, size_t x, size_t y, const MutablePixelView &out, ThreadPool &pool);
+
+// Parses a .bin held in memory, e.g. a MappedFile. The streams point into
+// data, which must outlive the returned image. Rejects a file whose header,
+// index or any block payload fails its CRC-32C, or whose footer is missing,
+// before decoding anything.
+EncodedImage readEncodedImage(const uint8_t *data, size_t size);
+
+#endif
@@ -1,41 +1,279 @@
 #include "compression.h"
+#include "pnm.h"
+#include <algorithm>
+#include <memory>
+#include <optional>
 
 using namespace std;
 
+static PixelView pixelView(const cv::Mat &img) {
+    return {img.ptr<uint8_t>(), img.cols * img.elemSize(), size_t(img.rows), img.step};
+}
+
+static MutablePixelView mutablePixelView(cv::Mat &img) {
+    return {img.ptr<uint8_t>(), img.cols * img.elemSize(), size_t(img.rows), img.step};
+}
+
+// Parameter that sets a format's lossy quality, or -1 when it has none
+static int qualityParam(const string &imageFormat) {
+    if (imageFormat == "jpg" || imageFormat == "jpeg") return cv::IMWRITE_JPEG_QUALITY;
+    if (imageFormat == "webp") return cv::IMWRITE_WEBP_QUALITY;
+    return -1;
+}
+
+// How far inside the target a trial may land and still end the search
+static const double kSizeSlack = 0.02;  // Fraction of the byte budget
+static const double kSsimSlack = 0.002;
+static const double kPsnrSlack = 0.25;  // dB
+
+SideImageChoice encodeSideImage(const cv::Mat &img, const string &imageFormat, const vector<int> &compressionParams,
+                                const QualityTarget &target, vector<uint8_t> &out) {
+    string ext = "." + imageFormat;
+    int key = qualityParam(imageFormat);
+    // Key/value pairs only; a trailing key without a value is dropped
+    vector<int> params(compressionParams.begin(), compressionParams.begin() + (compressionParams.size() & ~size_t(1)));
+    size_t slot = 0;
+    while (slot < params.size() && params[slot] != key) slot += 2;
+    bool given = key >= 0 && slot < params.size();
+
+    if (target.goal == QualityGoal::Fixed || key < 0) {
+        if (!cv::imencode(ext, img, out, params)) {
+            throw runtime_error("Error encoding compressed image!");
+        }
+        return {given ? params[slot + 1] : -1, true, 1};
+    }
+    if (!given) {
+        params.push_back(key);
+        params.push_back(0);
+    }
+
+    // File size, SSIM and PSNR all grow with quality. Each trial that meets
+    // the target is swapped into out, so only the winner survives and the
+    // loser's buffer takes the next trial.
+    bool bySize = target.goal == QualityGoal::MaxBytes;
+    double slack = target.goal == QualityGoal::MinSsim ? kSsimSlack : kPsnrSlack;
+    vector<uint8_t> trial;
+    cv::Mat decoded;
+    int lo = 1, hi = 100, best = -1, trials = 0;
+    while (lo <= hi) {
+        int quality = lo + (hi - lo) / 2;
+        params[slot + 1] = quality;
+        if (!cv::imencode(ext, img, trial, params)) {
+            throw runtime_error("Error encoding compressed image!");
+        }
+        trials++;
+        bool meets, close;
+        if (bySize) {
+            meets = trial.size() <= target.value;
+            close = trial.size() >= target.value * (1 - kSizeSlack);
+        } else {
+            cv::imdecode(trial, cv::IMREAD_UNCHANGED, &decoded);
+            if (decoded.rows != img.rows || decoded.cols != img.cols || decoded.type() != img.type()) {
+                throw runtime_error("Error decoding compressed image!");
+            }
+            double score = target.goal == QualityGoal::MinSsim
+                               ? ssim(pixelView(img), pixelView(decoded), img.channels())
+                               : psnr(pixelView(img), pixelView(decoded));
+            meets = score >= target.value;
+            close = score <= target.value + slack;
+        }
+        if (meets) {
+            best = quality;
+            out.swap(trial);
+            if (close) break;
+        }
+        if (meets == bySize) {
+            lo = quality + 1;
+        } else {
+            hi = quality - 1;
+        }
+    }
+    if (best >= 0) return {best, true, trials};
+
+    // Nothing reached the target; settle for the nearest end of the range
+    params[slot + 1] = bySize ? 1 : 100;
+    if (!cv::imencode(ext, img, out, params)) {
+        throw runtime_error("Error encoding compressed image!");
+    }
+    return {params[slot + 1], false, trials + 1};
+}
+
+CompressionContext &CompressionContext::shared() {
+    static CompressionContext context;
+    return context;
+}
+
+vector<uint8_t> readImageFile(const string &imagePath, CompressionStats *stats) {
+    ScopedTimer timer(stats, Stage::Read);
+    ifstream file(imagePath, ios::binary | ios::ate);
+    vector<uint8_t> bytes;
+    if (file) {
+        bytes.resize(size_t(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    }
+    if (!file || bytes.empty()) {
+        throw runtime_error("Error loading image!");
+    }
+    return bytes;
+}
+
+cv::Mat decodeImageFile(const vector<uint8_t> &bytes, CompressionStats *stats) {
+    ScopedTimer timer(stats, Stage::Read);
+    cv::Mat img = cv::imdecode(bytes, cv::IMREAD_COLOR);
+    if (img.empty()) {
+        throw runtime_error("Error loading image!");
+    }
+    return img;
+}
+
+cv::Mat loadImage(const string &imagePath, CompressionStats *stats, uint64_t *fileBytes) {
+    vector<uint8_t> bytes = readImageFile(imagePath, stats);
+    if (fileBytes) *fileBytes = bytes.size();
+    return decodeImageFile(bytes, stats);
+}
+
+// Blocks go to disk as they are coded rather than after the whole image
+static void writeBin(const cv::Mat &img, const string &binPath, CompressionContext &context, CompressionStats *stats) {
+    try {
+        optional<EncodedImageWriter> writer;
+        {
+            // The writer times its own writes; opening replaces the old file
+            ScopedTimer timer(stats, Stage::FileWrite);
+            writer.emplace(binPath, stats, &context.buffers());
+        }
+        EncodeOptions options;
+        options.stats = stats;
+        options.buffers = &context.buffers();
+        encodeImage(pixelView(img), img.cols, img.channels(), context.pool(), *writer, options);
+        uint64_t binBytes = writer->finish();
+        if (stats) stats->add(Counter::BinBytes, binBytes);
+    } catch (const runtime_error &e) {
+        throw runtime_error(string("Error saving compressed binary file: ") + e.what());
+    }
+}
+
+CompressedOutput encodeCompressed(const cv::Mat &img, const string &outputPath, const vector<int>& compressionParams,
+                                  CompressionContext &context, const string &imageFormat,
+                                  const QualityTarget &target, CompressionStats *stats) {
+    CompressedOutput output;
+    output.imageFormat = imageFormat;
+
+    // Huffman Encoding: row strips decorrelated (YCoCg-R + per-row predictor)
+    // and coded in parallel, reading the Mat in place
+    writeBin(img, outputPath + ".bin", context, stats);
+    if (stats) stats->add(Counter::BytesIn, pixelView(img).size());
+
+    // Side image (JPEG by default) with fixed or searched quality, encoded in
+    // memory so the writer only does I/O
+    ScopedTimer timer(stats, Stage::ImageWrite);
+    output.imageQuality = encodeSideImage(img, imageFormat, compressionParams, target, output.image).quality;
+    return output;
+}
+
+string sideImagePath(const string &outputPath, const string &imageFormat) {
+    return outputPath + "_compressed" + "." + imageFormat;
+}
+
+static string writeSideImage(const vector<uint8_t> &image, const string &outputPath, const string &imageFormat) {
+    string compressedImagePath = sideImagePath(outputPath, imageFormat);
+    // Moved into place like the .bin, so a failed write leaves nothing behind
+    // and a side image hard linked elsewhere is left alone
+    try {
+        BatchedFile file(compressedImagePath);
+        file.append(image.data(), image.size());
+        file.close();
+    } catch (const runtime_error &e) {
+        throw runtime_error(string("Error saving compressed image: ") + e.what());
+    }
+    return compressedImagePath;
+}
+
+string writeCompressed(const CompressedOutput &output, const string &outputPath, CompressionStats *stats) {
+    ScopedTimer timer(stats, Stage::ImageWrite);
+    if (stats) stats->add(Counter::ImageBytes, output.image.size());
+    return writeSideImage(output.image, outputPath, output.imageFormat);
+}
+
 void compressImage(const string &imagePath, const string &outputPath, 
-                   const vector<int>& compressionParams) {
+                   const vector<int>& compressionParams, const QualityTarget &target, CompressionStats *stats,
+                   CompressionContext &context) {
     cout << "Compressing: " << imagePath << " -> " << outputPath << endl;
     
-    cv::Mat img = cv::imread(imagePath, cv::IMREAD_COLOR);
-    if (img.empty()) {
-        throw runtime_error("Error loading image!");
+    cv::Mat img = loadImage(imagePath, stats);
+    if (stats) stats->add(Counter::BytesIn, pixelView(img).size());
+
+    writeBin(img, outputPath + ".bin", context, stats);
+
+    ScopedTimer timer(stats, Stage::ImageWrite);
+    vector<uint8_t> image = context.buffers().acquire(0);
+    SideImageChoice choice = encodeSideImage(img, "jpg", compressionParams, target, image);
+    string compressedImagePath = writeSideImage(image, outputPath, "jpg");
+    if (stats) stats->add(Counter::ImageBytes, image.size());
+    context.buffers().release(image);
+
+    cout << "Compressed image saved at: " << compressedImagePath;
+    if (target.goal != QualityGoal::Fixed) {
+        cout << " (quality " << choice.quality << (choice.targetMet ? "" : ", target not reached") << ")";
     }
+    cout << endl;
+}
 
-    // Converting pixel data to string
-    string pixelData(img.begin<unsigned char>(), img.end<unsigned char>());
+void compressImageStreaming(const string &imagePath, const string &outputPath, CompressionContext &context,
+                            CompressionStats *stats) {
+    cout << "Compressing (streaming): " << imagePath << " -> " << outputPath << endl;
 
-    // Huffman Encoding
-    unordered_map<char, string> codes;
-    unordered_map<string, char> reverseCodes;
-    Node* root = nullptr;
-    buildHuffmanTree(pixelData, codes, reverseCodes, root);
+    PnmReader reader(imagePath);
+    EncodedImageWriter writer(outputPath + ".bin", stats, &context.buffers());
+    EncodeOptions options;
+    options.stats = stats;
+    options.buffers = &context.buffers();
+    encodeStrips(reader.width(), reader.height(), reader.channels(),
+                 [&](size_t firstRow, size_t rowCount, uint8_t *out) { reader.readRows(firstRow, rowCount, out); },
+                 context.pool(), writer, options);
+    uint64_t binBytes = writer.finish();
+    if (stats) {
+        stats->add(Counter::BytesIn, uint64_t(reader.width()) * reader.height() * reader.channels());
+        stats->add(Counter::BinBytes, binBytes);
+    }
 
-    // Save Huffman Codes
-    saveHuffmanCodes(outputPath + ".bin" + ".codes", codes);
+    cout << "Compressed file saved at: " << outputPath << ".bin" << endl;
+}
 
-    // Encode data
-    string encodedData = encode(pixelData, codes);
+cv::Mat decompressImage(const string &binPath, CompressionContext &context) {
+    // Streams are decoded straight out of the mapping, never copied
+    unique_ptr<MappedFile> file;
+    try {
+        file.reset(new MappedFile(binPath));
+    } catch (const runtime_error &) {
+        throw runtime_error("Error opening compressed file!");
+    }
+    EncodedImage encoded = readEncodedImage(file->data(), file->size());
 
-    // Save compressed binary file
-    ofstream outFile(outputPath + ".bin", ios::binary);
-    outFile << img.cols << " " << img.rows << "\n" << encodedData;
-    outFile.close();
+    // Decode straight into the pixel buffer, one block per task
+    cv::Mat img(encoded.height, encoded.width, CV_8UC(encoded.channels));
+    decodeImage(encoded, mutablePixelView(img), context.pool(), &context.buffers());
+    return img;
+}
 
-    // Save compressed image as JPEG with variable quality
-    string compressedImagePath = outputPath + "_compressed" + ".jpg";
-    if (!cv::imwrite(compressedImagePath, img, compressionParams)) {
-        throw runtime_error("Error saving compressed image!");
+cv::Mat makeThumbnail(const cv::Mat &img, int maxSide) {
+    if (img.cols <= maxSide && img.rows <= maxSide) return img;
+    double scale = double(maxSide) / max(img.cols, img.rows);
+    cv::Size size(max(1, int(img.cols * scale + 0.5)), max(1, int(img.rows * scale + 0.5)));
+    cv::Mat thumbnail;
+    cv::resize(img, thumbnail, size, 0, 0, cv::INTER_AREA);
+    return thumbnail;
+}
+
+cv::Mat decodeRegion(const EncodedImageReader &reader, const cv::Rect &region) {
+    const EncodedImage &header = reader.header();
+    cv::Rect clipped = region & cv::Rect(0, 0, header.width, header.height);
+    if (clipped.empty()) {
+        throw invalid_argument("Region outside the image!");
     }
 
-    cout << "Compressed image saved at: " << compressedImagePath << endl;
+    cv::Mat img(clipped.height, clipped.width, CV_8UC(header.channels));
+    decodeRegion(reader, clipped.x, clipped.y, mutablePixelView(img), ThreadPool::shared());
+    return img;
 }
+
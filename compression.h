@@ -3,8 +3,98 @@
 
 #include <opencv2/opencv.hpp>
 #include "huffman.h"
+#include "codec.h"
+#include "quality.h"
+
+// What compressing reuses from one image to the next: the pool its tiles
+// are coded on and the buffers they are coded into or decoded with. Images
+// run through one context stop allocating scratch, streams, histograms and
+// decoder tables once it has seen the largest of them.
+class CompressionContext {
+public:
+    explicit CompressionContext(ThreadPool &pool = ThreadPool::shared()) : threads(pool) {}
+
+    CompressionContext(const CompressionContext &) = delete;
+    CompressionContext &operator=(const CompressionContext &) = delete;
+
+    ThreadPool &pool() const { return threads; }
+    BufferPool &buffers() { return bufferPool; }
+    // Peak bytes held in recycled buffers at once
+    size_t highWaterBytes() const { return bufferPool.highWaterBytes(); }
+
+    // Process-wide context on ThreadPool::shared(), the default for the
+    // functions below
+    static CompressionContext &shared();
+
+private:
+    ThreadPool &threads;
+    BufferPool bufferPool;
+};
+
+// What compressing one image holds in memory until it is written; the .bin
+// goes to disk block by block while it is coded
+struct CompressedOutput {
+    std::string imageFormat;
+    std::vector<uint8_t> image;
+    int imageQuality = -1;  // Quality the side image was encoded at, -1 for png
+};
+
+// How a side image encode went. targetMet is false when no quality reaches
+// the target; the closest one (lowest for a size, highest for SSIM or PSNR)
+// is used instead.
+struct SideImageChoice {
+    int quality;     // -1 for formats without a quality setting
+    bool targetMet;
+    int trials;      // Encodes the search took
+};
+
+// Encodes img as imageFormat into out. With a target, the quality in
+// compressionParams is replaced by a binary search over 1-100 in memory,
+// decoding each trial into one reused Mat when the target is SSIM or PSNR;
+// the search stops as soon as a trial lands just inside the target. png has
+// no quality, so its target is ignored.
+SideImageChoice encodeSideImage(const cv::Mat &img, const std::string &imageFormat,
+                                const std::vector<int> &compressionParams, const QualityTarget &target,
+                                std::vector<uint8_t> &out);
+
+// The stages of compressImage(), usable separately by pipelined callers.
+// Each records its timings and counters into stats when one is given.
+// encodeCompressed() writes outputPath + ".bin" through an
+// EncodedImageWriter as its blocks finish and encodes the side image into
+// memory; writeCompressed() then writes the side image.
+// loadImage() reads the file once and decodes it from memory; fileBytes
+// receives the file's size. readImageFile() and decodeImageFile() are its
+// two halves, for callers that look at the bytes before decoding them.
+cv::Mat loadImage(const std::string &imagePath, CompressionStats *stats = nullptr, uint64_t *fileBytes = nullptr);
+std::vector<uint8_t> readImageFile(const std::string &imagePath, CompressionStats *stats = nullptr);
+cv::Mat decodeImageFile(const std::vector<uint8_t> &bytes, CompressionStats *stats = nullptr);
+CompressedOutput encodeCompressed(const cv::Mat &img, const std::string &outputPath,
+                                  const std::vector<int>& compressionParams,
+                                  CompressionContext &context, const std::string &imageFormat = "jpg",
+                                  const QualityTarget &target = QualityTarget(), CompressionStats *stats = nullptr);
+std::string writeCompressed(const CompressedOutput &output, const std::string &outputPath,
+                            CompressionStats *stats = nullptr);
+// Where the side image for outputPath goes
+std::string sideImagePath(const std::string &outputPath, const std::string &imageFormat);
 
 void compressImage(const std::string &imagePath, const std::string &outputPath, 
-                   const std::vector<int>& compressionParams = {cv::IMWRITE_JPEG_QUALITY, 50});
+                   const std::vector<int>& compressionParams = {cv::IMWRITE_JPEG_QUALITY, 50},
+                   const QualityTarget &target = QualityTarget(), CompressionStats *stats = nullptr,
+                   CompressionContext &context = CompressionContext::shared());
+cv::Mat decompressImage(const std::string &binPath, CompressionContext &context = CompressionContext::shared());
+
+// img shrunk to fit maxSide x maxSide, keeping its aspect ratio; images
+// that already fit come back as they are, sharing img's pixels
+cv::Mat makeThumbnail(const cv::Mat &img, int maxSide);
+
+// Decodes only the tiles of reader's .bin that overlap region, clipped to
+// the image
+cv::Mat decodeRegion(const EncodedImageReader &reader, const cv::Rect &region);
+
+// Writes only the .bin, reading a binary PGM/PPM a strip at a time so the
+// image never has to fit in memory
+void compressImageStreaming(const std::string &imagePath, const std::string &outputPath,
+                            CompressionContext &context = CompressionContext::shared(),
+                            CompressionStats *stats = nullptr);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,81 @@
+#include "crc32c.h"
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_HAVE_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+using namespace std;
+
+// Reflected Castagnoli polynomial
+static const uint32_t kPolynomial = 0x82f63b78;
+
+// Slicing-by-8 tables: kTables[k][b] is the CRC of byte b followed by k zero bytes
+struct CrcTables {
+    uint32_t t[8][256];
+
+    CrcTables() {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; ++i) crc = (crc >> 1) ^ (kPolynomial & (0u - (crc & 1)));
+            t[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; ++b) {
+            for (int k = 1; k < 8; ++k) t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xff];
+        }
+    }
+};
+
+static const CrcTables kTables;
+
+static uint32_t scalarKernel(const uint8_t *data, size_t size, uint32_t crc) {
+    const uint32_t (*t)[256] = kTables.t;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for (; size > 0; ++data, --size) crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t sse42Kernel(const uint8_t *data, size_t size, uint32_t crc) {
+    uint64_t c = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+    }
+    crc = uint32_t(c);
+    for (; size > 0; ++data, --size) crc = _mm_crc32_u8(crc, *data);
+    return crc;
+}
+#endif
+
+typedef uint32_t (*CrcKernel)(const uint8_t *, size_t, uint32_t);
+
+static CrcKernel selectKernel() {
+#ifdef CRC32C_HAVE_SSE42
+    if (__builtin_cpu_supports("sse4.2")) return sse42Kernel;
+#endif
+    return scalarKernel;
+}
+
+uint32_t crc32c(const uint8_t *data, size_t size, uint32_t crc) {
+    static const CrcKernel kernel = selectKernel();
+    return ~kernel(data, size, ~crc);
+}
+
+uint32_t crc32cScalar(const uint8_t *data, size_t size, uint32_t crc) {
+    return ~scalarKernel(data, size, ~crc);
+}
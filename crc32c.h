@@ -0,0 +1,17 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// CRC-32C (Castagnoli) of data[0, size), continuing from crc so that
+// crc32c(b, crc32c(a)) equals the checksum of a followed by b. Picks the
+// SSE4.2 instruction when the CPU has it.
+uint32_t crc32c(const uint8_t *data, size_t size, uint32_t crc = 0);
+
+// Table-driven fallback; the bench's crc32c_scalar stage compares it with crc32c()
+uint32_t crc32cScalar(const uint8_t *data, size_t size, uint32_t crc = 0);
+
+#endif
@@ -0,0 +1,142 @@
+#include "fileio.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define FILEIO_O_BINARY O_BINARY
+#define lseek _lseeki64
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FILEIO_O_BINARY 0
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Message naming the failed call's cause, e.g. a full disk
+static string writeError() {
+    return string("Error writing file: ") + strerror(errno) + "!";
+}
+
+MappedFile::MappedFile(const string &path, Access access) : bytes(nullptr), length(0), mapped(false) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Error opening file!");
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            // Front to back reads want read-ahead and can let pages behind
+            // go; scattered ones would only drag in pages never touched
+            madvise(p, size_t(st.st_size), access == Access::Random ? MADV_RANDOM : MADV_SEQUENTIAL);
+            bytes = static_cast<const uint8_t*>(p);
+            length = size_t(st.st_size);
+            mapped = true;
+        }
+    }
+    ::close(fd);
+    if (mapped) return;
+#endif
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in) {
+        throw runtime_error("Error opening file!");
+    }
+    copy.resize(size_t(in.tellg()));
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(copy.data()), copy.size())) {
+        throw runtime_error("Error reading file!");
+    }
+    bytes = copy.data();
+    length = copy.size();
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (mapped) munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+}
+
+BatchedFile::BatchedFile(const string &path) : path(path), tempPath(path + ".tmp"), written(0) {
+    fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | FILEIO_O_BINARY, 0644);
+    if (fd < 0) {
+        throw runtime_error(writeError());
+    }
+    buffer.reserve(kWriteBatchSize);
+}
+
+BatchedFile::~BatchedFile() {
+    if (fd < 0) return;
+    ::close(fd);
+    ::remove(tempPath.c_str());
+}
+
+void BatchedFile::writeAll(const uint8_t *data, size_t size) {
+    while (size > 0) {
+        auto n = ::write(fd, data, size);
+        if (n <= 0) {
+            throw runtime_error(writeError());
+        }
+        data += n;
+        size -= size_t(n);
+        written += uint64_t(n);
+    }
+}
+
+void BatchedFile::flush() {
+    writeAll(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+void BatchedFile::append(const void *data, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    if (buffer.size() + size <= kWriteBatchSize) {
+        buffer.insert(buffer.end(), p, p + size);
+        return;
+    }
+    flush();
+    // Large payloads skip the buffer
+    if (size >= kWriteBatchSize) {
+        writeAll(p, size);
+    } else {
+        buffer.insert(buffer.end(), p, p + size);
+    }
+}
+
+void BatchedFile::writeAt(uint64_t offset, const void *data, size_t size) {
+    if (offset + size > this->size()) {
+        throw invalid_argument("Write past the end of the file!");
+    }
+    flush();
+    uint64_t end = written;
+    if (lseek(fd, offset, SEEK_SET) < 0) {
+        throw runtime_error(writeError());
+    }
+    writeAll(static_cast<const uint8_t*>(data), size);
+    written = end;
+    if (lseek(fd, end, SEEK_SET) < 0) {
+        throw runtime_error(writeError());
+    }
+}
+
+void BatchedFile::close() {
+    flush();
+    int result = ::close(fd);
+    fd = -1;
+    error_code ec;
+    if (result == 0) fs::rename(tempPath, path, ec);
+    if (result != 0 || ec) {
+        string message = result != 0 ? writeError() : "Error writing file: " + ec.message() + "!";
+        ::remove(tempPath.c_str());
+        throw runtime_error(message);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Read-only view of a whole file. Memory mapped where the platform allows,
+// so pages load on demand and can be dropped again under memory pressure.
+class MappedFile {
+public:
+    // How the mapping will be read, passed on to the kernel's read-ahead
+    enum class Access { Sequential, Random };
+
+    explicit MappedFile(const string &path, Access access = Access::Sequential);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const uint8_t *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const uint8_t *bytes;
+    size_t length;
+    bool mapped;
+    vector<uint8_t> copy;  // Used when the file can't be mapped
+};
+
+// Bytes gathered before each write() call
+const size_t kWriteBatchSize = size_t(1) << 20;
+
+// Sequential file writer that turns many small appends into a few large
+// write() calls. Earlier bytes can be patched in place, e.g. an index whose
+// contents are only known once the data after it has been written. The
+// bytes go to a file beside path that close() renames over it, so a writer
+// that fails or is dropped leaves no partial file, and other names hard
+// linked to the old file keep their contents.
+class BatchedFile {
+public:
+    explicit BatchedFile(const string &path);
+    ~BatchedFile();
+
+    BatchedFile(const BatchedFile &) = delete;
+    BatchedFile &operator=(const BatchedFile &) = delete;
+
+    void append(const void *data, size_t size);
+    void writeAt(uint64_t offset, const void *data, size_t size);
+    uint64_t size() const { return written + buffer.size(); }
+
+    // Flushes, closes and moves the file into place, throwing if any write
+    // failed
+    void close();
+
+private:
+    void flush();
+    void writeAll(const uint8_t *data, size_t size);
+
+    string path;
+    string tempPath;
+    int fd;
+    uint64_t written;
+    vector<uint8_t> buffer;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "gui.h"
 #include "compression.h"
+#include "previewcache.h"
 #include <QDebug>
 #include <QDir>
 #include <QFileInfo>
@@ -9,41 +10,202 @@
 #include <QMimeData>
 #include <QStyledItemDelegate>
 #include <QMessageBox>
+#include <cmath>
 
 using namespace std;
 
-ImagePreviewLabel::ImagePreviewLabel(QWidget *parent) : QLabel(parent) {
+// Deepest zoom, relative to fitting the whole image in the label
+static const double kMaxZoom = 64.0;
+// Quiet time after the last wheel or resize event before tiles are decoded
+static const int kRegionDecodeDelayMs = 80;
+
+ImagePreviewLabel::ImagePreviewLabel(QWidget *parent)
+    : QLabel(parent), regionTimer(new QTimer(this)), zoom(1.0), center(0.5, 0.5) {
     setAlignment(Qt::AlignCenter);
     setStyleSheet("background-color: #F0F0F0; border: 2px dashed #CCCCCC; border-radius: 10px;");
+    regionTimer->setSingleShot(true);
+    regionTimer->setInterval(kRegionDecodeDelayMs);
+    connect(regionTimer, &QTimer::timeout, this, &ImagePreviewLabel::decodeVisibleRegion);
 }
 
-void ImagePreviewLabel::setPixmap(const QString &imagePath) {
-    originalPixmap = QPixmap(imagePath);
+void ImagePreviewLabel::setImage(const QImage &image, const QSize &fullSize) {
+    originalImage = image;
+    compressedSource.clear();
+    decodedView = QImage();
+    imageSize = fullSize.isValid() ? fullSize : originalImage.size();
+    zoom = 1.0;
+    center = QPointF(0.5, 0.5);
     
     updateScaledPixmap();
 }
 
+void ImagePreviewLabel::setCompressedSource(const QString &binPath) {
+    compressedSource = binPath;
+    decodedView = QImage();
+    if (!binPath.isEmpty()) {
+        QDateTime modified = QFileInfo(binPath).lastModified();
+        try {
+            if (!reader || binPath != readerPath || modified != readerModified) {
+                reader.reset();
+                reader = make_shared<EncodedImageReader>(binPath.toStdString());
+                readerPath = binPath;
+                readerModified = modified;
+            }
+            if (imageSize.isEmpty()) imageSize = QSize(reader->header().width, reader->header().height);
+        } catch (const exception &) {
+            compressedSource.clear();
+        }
+    }
+    updateScaledPixmap();
+}
+
 void ImagePreviewLabel::resizeEvent(QResizeEvent *event) {
     QLabel::resizeEvent(event);
     updateScaledPixmap();
 }
 
+void ImagePreviewLabel::wheelEvent(QWheelEvent *event) {
+    if (imageSize.isEmpty()) {
+        QLabel::wheelEvent(event);
+        return;
+    }
+    // Zoom about the cursor: the image point under it stays put
+    QRect region = visibleRegion();
+    QPointF cursor(event->position().x() / qMax(1, width()), event->position().y() / qMax(1, height()));
+    QPointF anchor(region.x() + cursor.x() * region.width(), region.y() + cursor.y() * region.height());
+    zoom = qBound(1.0, zoom * pow(1.25, event->angleDelta().y() / 120.0), kMaxZoom);
+    center = QPointF((anchor.x() + (0.5 - cursor.x()) * imageSize.width() / zoom) / imageSize.width(),
+                     (anchor.y() + (0.5 - cursor.y()) * imageSize.height() / zoom) / imageSize.height());
+    updateScaledPixmap();
+    event->accept();
+}
+
+QRect ImagePreviewLabel::visibleRegion() const {
+    int w = qMax(1, int(imageSize.width() / zoom)), h = qMax(1, int(imageSize.height() / zoom));
+    int x = qBound(0, int(center.x() * imageSize.width() - w / 2.0), imageSize.width() - w);
+    int y = qBound(0, int(center.y() * imageSize.height() - h / 2.0), imageSize.height() - h);
+    return QRect(x, y, w, h);
+}
+
 void ImagePreviewLabel::updateScaledPixmap() {
-    if (originalPixmap.isNull()) {
+    QImage view = originalImage;
+    if (zoom > 1.0 && !imageSize.isEmpty()) {
+        // Decode only the tiles under the view rather than the whole image
+        QRect region = visibleRegion();
+        view = QImage();
+        if (!compressedSource.isEmpty()) {
+            if (region == decodedRegion && !decodedView.isNull()) {
+                view = decodedView;
+            } else {
+                regionTimer->start();
+            }
+        }
+        if (view.isNull() && !originalImage.isNull()) {
+            // A thumbnail is cropped at its own scale
+            double sx = double(originalImage.width()) / imageSize.width();
+            double sy = double(originalImage.height()) / imageSize.height();
+            view = originalImage.copy(QRect(int(region.x() * sx), int(region.y() * sy),
+                                            qMax(1, int(region.width() * sx)), qMax(1, int(region.height() * sy))));
+        }
+    }
+
+    if (view.isNull()) {
         setText("No Image");
         return;
     }
 
-    QPixmap scaledPixmap = originalPixmap.scaled(
+    // Scale before converting so only the on-screen pixels become a pixmap
+    QImage scaledImage = view.scaled(
         size(), 
         Qt::KeepAspectRatio, 
         Qt::SmoothTransformation
     );
     
-    QLabel::setPixmap(scaledPixmap);
+    QLabel::setPixmap(QPixmap::fromImage(scaledImage));
+}
+
+void ImagePreviewLabel::decodeVisibleRegion() {
+    if (compressedSource.isEmpty() || zoom <= 1.0 || imageSize.isEmpty()) return;
+    QRect region = visibleRegion();
+    try {
+        cv::Rect rect(region.x(), region.y(), region.width(), region.height());
+        decodedView = matToQImage(decodeRegion(*reader, rect));
+        decodedRegion = region;
+    } catch (const exception &) {
+        // A damaged .bin leaves the thumbnail in charge
+        compressedSource.clear();
+    }
+    updateScaledPixmap();
+}
+
+// Metadata table rows for the timings and counters of one compression
+static QString statsRows(const CompressionStats &stats, int imageQuality, bool cached) {
+    QString rows;
+    if (cached) rows += "<tr><td><b>Output:</b></td><td>reused, source unchanged</td></tr>";
+    if (imageQuality >= 0) rows += QString("<tr><td><b>JPEG quality:</b></td><td>%1</td></tr>").arg(imageQuality);
+    for (size_t i = 0; i < kStageCount; ++i) {
+        rows += QString("<tr><td><b>%1:</b></td><td>%2 ms</td></tr>")
+            .arg(stageName(Stage(i)))
+            .arg(stats.seconds(Stage(i)) * 1000.0, 0, 'f', 2);
+    }
+    rows += QString("<tr><td><b>Bytes in/out:</b></td><td>%1 → %2 (.bin) + %3 (image)</td></tr>")
+        .arg(stats.count(Counter::BytesIn))
+        .arg(stats.count(Counter::BinBytes))
+        .arg(stats.count(Counter::ImageBytes));
+    rows += QString("<tr><td><b>Entropy:</b></td><td>%1 bits/byte</td></tr>").arg(stats.entropy(), 0, 'f', 3);
+    rows += QString("<tr><td><b>Avg code length:</b></td><td>%1 bits/byte</td></tr>")
+        .arg(stats.averageCodeLength(), 0, 'f', 3);
+    return rows;
+}
+
+BatchCompressionWorker::BatchCompressionWorker(const vector<BatchJob> &jobs, const string &outputDir, QObject *parent)
+    : QObject(parent), jobs(jobs), index(outputDir + kOutputIndexName) {
+    compressor.setThumbnailSize(kPreviewThumbnailSize);
+    compressor.setOutputIndex(&index);
+}
+
+void BatchCompressionWorker::cancel() {
+    compressor.cancel();
+}
+
+void BatchCompressionWorker::run() {
+    int successCount = 0;
+    int failCount = 0;
+    compressor.run(jobs, [&](const BatchResult &result) {
+        // The side image is decoded here, off the GUI thread, from the bytes
+        // just written, and the source preview comes from the compressor's
+        // own decode, so showing either later needs no disk read. Reused
+        // outputs come with neither and are previewed from disk on demand.
+        QImage compressedPreview, originalPreview;
+        if (result.success) {
+            successCount++;
+            compressedPreview = QImage::fromData(result.compressedImage.data(), int(result.compressedImage.size()));
+            const Thumbnail &thumbnail = result.thumbnail;
+            if (!thumbnail.pixels.empty()) {
+                cv::Mat pixels(int(thumbnail.height), int(thumbnail.width), CV_8UC(thumbnail.channels),
+                               const_cast<uint8_t *>(thumbnail.pixels.data()));
+                originalPreview = matToQImage(pixels);
+            }
+        } else {
+            failCount++;
+        }
+        emit fileFinished(QString::fromStdString(result.imagePath),
+                          QString::fromStdString(result.compressedImagePath),
+                          result.success,
+                          QString::fromStdString(result.error),
+                          result.originalSize,
+                          result.compressedSize,
+                          result.success ? statsRows(result.stats, result.imageQuality, result.cached) : QString(),
+                          compressedPreview,
+                          originalPreview,
+                          QSize(int(result.width), int(result.height)));
+    });
+    index.save();
+    emit finished(successCount, failCount, compressor.isCancelled());
 }
 
-ImageCompressionGUI::ImageCompressionGUI(QWidget *parent) : QWidget(parent), compressionQuality(50) {
+ImageCompressionGUI::ImageCompressionGUI(QWidget *parent)
+    : QWidget(parent), batchThread(nullptr), batchWorker(nullptr), batchTotal(0), batchDone(0), compressionQuality(50) {
     this->setWindowTitle("Image Compression");
     this->resize(800, 700);
     this->setStyleSheet("background-color: #F5F5F5; color: #333333;");
@@ -55,6 +217,8 @@ ImageCompressionGUI::ImageCompressionGUI(QWidget *parent) : QWidget(parent), com
     compressedImageBtn = new QPushButton("Compressed", this);
     qualityLabel = new QLabel("Compression Quality: 100%", this);
     qualitySlider = new QSlider(Qt::Horizontal, this);
+    qualityModeBox = new QComboBox(this);
+    qualityTargetBox = new QDoubleSpinBox(this);
     statusLabel = new QLabel("Drag and drop images or click 'Add Files'", this);
     
     QVBoxLayout *mainLayout = new QVBoxLayout(this);
@@ -98,6 +262,17 @@ ImageCompressionGUI::ImageCompressionGUI(QWidget *parent) : QWidget(parent), com
     qualityLayout->addWidget(new QLabel("High"));
     cardLayout->addLayout(qualityLayout);
     cardLayout->addWidget(qualityLabel);
+
+    // Instead of the slider, a target the quality is searched for
+    QHBoxLayout *targetLayout = new QHBoxLayout();
+    qualityModeBox->addItem("Fixed quality", int(QualityGoal::Fixed));
+    qualityModeBox->addItem("Target size (KB)", int(QualityGoal::MaxBytes));
+    qualityModeBox->addItem("Minimum SSIM", int(QualityGoal::MinSsim));
+    qualityModeBox->addItem("Minimum PSNR (dB)", int(QualityGoal::MinPsnr));
+    targetLayout->addWidget(qualityModeBox);
+    targetLayout->addWidget(qualityTargetBox);
+    cardLayout->addLayout(targetLayout);
+    updateQualityMode(0);
     
     // Preview Layout with File List and Image Preview
     QHBoxLayout *previewLayout = new QHBoxLayout();
@@ -215,7 +390,7 @@ ImageCompressionGUI::ImageCompressionGUI(QWidget *parent) : QWidget(parent), com
     );
     
     // Compress button
-    QPushButton *compressButton = new QPushButton("COMPRESS", this);
+    compressButton = new QPushButton("COMPRESS", this);
     compressButton->setStyleSheet(
         "QPushButton {"
         "   background-color:rgb(26, 43, 198);"
@@ -259,6 +434,8 @@ ImageCompressionGUI::ImageCompressionGUI(QWidget *parent) : QWidget(parent), com
             this, &ImageCompressionGUI::handleBatchCompression);
     connect(qualitySlider, &QSlider::valueChanged, 
             this, &ImageCompressionGUI::updateCompressionQuality);
+    connect(qualityModeBox, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &ImageCompressionGUI::updateQualityMode);
 }
 
 void ImageCompressionGUI::updatePreview(QListWidgetItem *current) {
@@ -272,11 +449,13 @@ void ImageCompressionGUI::updatePreview(QListWidgetItem *current) {
     QString imagePath = current->text();
     
     try {
-        previewLabel->setPixmap(imagePath);
+        PreviewEntry preview = previewCache.load(imagePath, binFilePaths.value(imagePath));
+        previewLabel->setImage(preview.image, preview.fullSize);
         
         if (compressedFilePaths.contains(imagePath)) {
             lastCompressedImagePath = compressedFilePaths[imagePath];
             compressedImageBtn->setEnabled(true);
+            previewLabel->setCompressedSource(binFilePaths.value(imagePath));
         } else {
             lastCompressedImagePath.clear();
             compressedImageBtn->setEnabled(false);
@@ -344,7 +523,32 @@ void ImageCompressionGUI::updateCompressionQuality(int value) {
     qualityLabel->setText(QString("Compression Quality: %1%").arg(displayValue));
 }
 
+void ImageCompressionGUI::updateQualityMode(int index) {
+    QualityGoal goal = QualityGoal(qualityModeBox->itemData(index).toInt());
+    qualitySlider->setEnabled(goal == QualityGoal::Fixed);
+    qualityTargetBox->setEnabled(goal != QualityGoal::Fixed);
+    if (goal == QualityGoal::MaxBytes) {
+        qualityTargetBox->setDecimals(0);
+        qualityTargetBox->setRange(1, 1024 * 1024);
+        qualityTargetBox->setValue(200);
+    } else if (goal == QualityGoal::MinSsim) {
+        qualityTargetBox->setDecimals(3);
+        qualityTargetBox->setRange(0, 1);
+        qualityTargetBox->setSingleStep(0.01);
+        qualityTargetBox->setValue(0.95);
+    } else if (goal == QualityGoal::MinPsnr) {
+        qualityTargetBox->setDecimals(1);
+        qualityTargetBox->setRange(10, 100);
+        qualityTargetBox->setSingleStep(0.5);
+        qualityTargetBox->setValue(35);
+    }
+}
+
 void ImageCompressionGUI::removeSelectedFiles() {
+    for (QListWidgetItem *item : fileListWidget->selectedItems()) {
+        previewCache.remove(item->text());
+        previewCache.remove(compressedFilePaths.value(item->text()));
+    }
     qDeleteAll(fileListWidget->selectedItems());
 }
 
@@ -378,7 +582,24 @@ void ImageCompressionGUI::handleCompression() {
     }
 }
 
+ImageCompressionGUI::~ImageCompressionGUI() {
+    if (batchThread) {
+        batchWorker->cancel();
+        batchThread->quit();
+        batchThread->wait();
+        delete batchWorker;
+    }
+}
+
 void ImageCompressionGUI::handleBatchCompression() {
+    // The button doubles as cancel while a batch is running
+    if (batchWorker) {
+        batchWorker->cancel();
+        compressButton->setEnabled(false);
+        statusLabel->setText("Cancelling...");
+        return;
+    }
+
     if (fileListWidget->count() == 0) {
         statusLabel->setText("❌ No files selected for compression");
         statusLabel->setStyleSheet("color: red;");
@@ -388,60 +609,88 @@ void ImageCompressionGUI::handleBatchCompression() {
     QString outputDir = "../output/";
     QDir().mkpath(outputDir);
 
-    int totalFiles = fileListWidget->count();
-    int successCount = 0;
-    int failCount = 0;
+    QualityTarget target;
+    target.goal = QualityGoal(qualityModeBox->currentData().toInt());
+    target.value = qualityTargetBox->value();
+    if (target.goal == QualityGoal::MaxBytes) target.value *= 1024;
 
+    vector<BatchJob> jobs;
     for (int i = 0; i < fileListWidget->count(); ++i) {
         QString filePath = fileListWidget->item(i)->text();
-        QFileInfo fileInfo(filePath);
-        QString baseName = fileInfo.completeBaseName();
-        QString binFile = outputDir + baseName;
+        QString binFile = outputDir + QFileInfo(filePath).completeBaseName();
+        binFilePaths[filePath] = binFile + ".bin";
+        jobs.push_back({filePath.toStdString(), binFile.toStdString(), {cv::IMWRITE_JPEG_QUALITY, compressionQuality},
+                        "jpg", target});
+    }
+    batchTotal = jobs.size();
+    batchDone = 0;
 
-        QFile inputFile(filePath);
-        qint64 originalSize = inputFile.size();
+    batchThread = new QThread(this);
+    batchWorker = new BatchCompressionWorker(jobs, outputDir.toStdString());
+    batchWorker->moveToThread(batchThread);
 
-        vector<int> compressionParams = {cv::IMWRITE_JPEG_QUALITY, compressionQuality};
-        QString compressedImage = binFile + "_compressed.jpg";
+    connect(batchThread, &QThread::started, batchWorker, &BatchCompressionWorker::run);
+    connect(batchWorker, &BatchCompressionWorker::fileFinished,
+            this, &ImageCompressionGUI::handleBatchFileFinished, Qt::QueuedConnection);
+    connect(batchWorker, &BatchCompressionWorker::finished,
+            this, &ImageCompressionGUI::handleBatchFinished, Qt::QueuedConnection);
 
-        try {
-            compressImage(filePath.toStdString(), binFile.toStdString(), compressionParams);
-            
-            QFile outputFile(compressedImage);
-            qint64 compressedSize = 0;
-            
-            if (outputFile.exists()) {
-                compressedSize = outputFile.size();
-                
-                compressedFilePaths[filePath] = compressedImage;
-                
-                if (fileListWidget->currentItem() && fileListWidget->currentItem()->text() == filePath) {
-                    lastCompressedImagePath = compressedImage;
-                    compressedImageBtn->setEnabled(true);
-                    updateMetadata(compressedImage);
-                }
-            }
-            
-            statusLabel->setText(
-                QString("Compressed: %1\nOriginal: %2 KB → Compressed: %3 KB")
-                .arg(fileInfo.fileName())
-                .arg(originalSize / 1024)
-                .arg(compressedSize / 1024)
-            );
+    compressButton->setText("CANCEL");
+    statusLabel->setText(QString("Compressing %1 files...").arg(batchTotal));
+    statusLabel->setStyleSheet("color: #666666; font-family: 'Segoe UI', Arial; font-size: 14px; margin-top: 10px;");
+    batchThread->start();
+}
 
-            successCount++;
-        } catch (const exception& e) {
-            statusLabel->setText(QString("Error compressing %1: %2")
-                .arg(fileInfo.fileName())
-                .arg(e.what()));
-            failCount++;
-        }
+void ImageCompressionGUI::handleBatchFileFinished(const QString &imagePath, const QString &compressedImagePath, bool success,
+                                                  const QString &error, qint64 originalSize, qint64 compressedSize,
+                                                  const QString &stats, const QImage &compressedPreview,
+                                                  const QImage &originalPreview, const QSize &imageSize) {
+    batchDone++;
+    QString fileName = QFileInfo(imagePath).fileName();
+
+    if (!success) {
+        statusLabel->setText(QString("Error compressing %1: %2")
+            .arg(fileName)
+            .arg(error));
+        return;
+    }
 
-        QApplication::processEvents();
+    compressedFilePaths[imagePath] = compressedImagePath;
+    compressionStats[imagePath] = stats;
+    if (!compressedPreview.isNull()) previewCache.insert(compressedImagePath, compressedPreview);
+    if (!originalPreview.isNull()) previewCache.insert(imagePath, originalPreview, imageSize);
+
+    if (fileListWidget->currentItem() && fileListWidget->currentItem()->text() == imagePath) {
+        lastCompressedImagePath = compressedImagePath;
+        compressedImageBtn->setEnabled(true);
+        if (originalImageBtn->isChecked()) previewLabel->setCompressedSource(binFilePaths.value(imagePath));
+        updateMetadata(compressedImagePath);
     }
 
     statusLabel->setText(
-        QString("Batch Compression Complete\n ✅ Successful: %1 | ❌ Failed: %2")
+        QString("Compressed %1/%2: %3\nOriginal: %4 KB → Compressed: %5 KB")
+        .arg(batchDone)
+        .arg(batchTotal)
+        .arg(fileName)
+        .arg(originalSize / 1024)
+        .arg(compressedSize / 1024)
+    );
+}
+
+void ImageCompressionGUI::handleBatchFinished(int successCount, int failCount, bool cancelled) {
+    // run() has returned, so the thread only needs its event loop stopped
+    batchThread->quit();
+    batchThread->wait();
+    delete batchWorker;
+    delete batchThread;
+    batchWorker = nullptr;
+    batchThread = nullptr;
+    compressButton->setText("COMPRESS");
+    compressButton->setEnabled(true);
+
+    statusLabel->setText(
+        QString("Batch Compression %1\n ✅ Successful: %2 | ❌ Failed: %3")
+        .arg(cancelled ? "Cancelled" : "Complete")
         .arg(successCount).arg(failCount)
     );
     statusLabel->setStyleSheet("color: #4CAF50; font-size: 16px;");
@@ -450,7 +699,11 @@ void ImageCompressionGUI::handleBatchCompression() {
 void ImageCompressionGUI::showOriginalImage() {
     QListWidgetItem *current = fileListWidget->currentItem();
     if (current) {
-        previewLabel->setPixmap(current->text());
+        PreviewEntry preview = previewCache.load(current->text(), binFilePaths.value(current->text()));
+        previewLabel->setImage(preview.image, preview.fullSize);
+        if (compressedFilePaths.contains(current->text())) {
+            previewLabel->setCompressedSource(binFilePaths.value(current->text()));
+        }
         originalImageBtn->setChecked(true);
         compressedImageBtn->setChecked(false);
         updateMetadata();
@@ -459,7 +712,7 @@ void ImageCompressionGUI::showOriginalImage() {
 
 void ImageCompressionGUI::showCompressedImage() {
     if (!lastCompressedImagePath.isEmpty() && QFile::exists(lastCompressedImagePath)) {
-        previewLabel->setPixmap(lastCompressedImagePath);
+        previewLabel->setImage(previewCache.load(lastCompressedImagePath).image);
         originalImageBtn->setChecked(false);
         compressedImageBtn->setChecked(true);
         updateMetadata(lastCompressedImagePath);
@@ -486,13 +739,12 @@ void ImageCompressionGUI::updateMetadata(const QString &filePath) {
     qint64 sizeInBytes = fileInfo.size();
     QString lastModified = fileInfo.lastModified().toString("yyyy-MM-dd hh:mm:ss");
     
+    // The preview or the compressor already decoded this file, so its size
+    // comes from the cache
     QString dimensions = "Unknown";
-    try {
-        QImage img(path);
-        if (!img.isNull()) {
-            dimensions = QString("%1 x %2").arg(img.width()).arg(img.height());
-        }
-    } catch (...) {
+    QSize imageSize = previewCache.load(path).fullSize;
+    if (imageSize.isValid()) {
+        dimensions = QString("%1 x %2").arg(imageSize.width()).arg(imageSize.height());
     }
     
     QString sizeStr;
@@ -504,12 +756,17 @@ void ImageCompressionGUI::updateMetadata(const QString &filePath) {
         sizeStr = QString("%1 MB").arg(sizeInBytes / (1024.0 * 1024.0), 0, 'f', 2);
     }
     
+    // Where the time went, once the selected image has been compressed
+    QString stats;
+    if (fileListWidget->currentItem()) stats = compressionStats.value(fileListWidget->currentItem()->text());
+
     metadataLabel->setText(QString(
         "<table style='margin-top:5px;'>"
         "<tr><td><b>File:</b></td><td>%1</td></tr>"
         "<tr><td><b>Size:</b></td><td>%2</td></tr>"
         "<tr><td><b>Dimensions:</b></td><td>%3</td></tr>"
         "<tr><td><b>Modified:</b></td><td>%4</td></tr>"
+        "%5"
         "</table>"
-    ).arg(fileName).arg(sizeStr).arg(dimensions).arg(lastModified));
+    ).arg(fileName).arg(sizeStr).arg(dimensions).arg(lastModified).arg(stats));
 }
@@ -10,27 +10,87 @@
 #include <QLabel>
 #include <QDropEvent>
 #include <QDragEnterEvent>
+#include <QWheelEvent>
 #include <QListWidget>
 #include <QSlider>
+#include <QComboBox>
+#include <QDoubleSpinBox>
 #include <QScrollArea>
 #include <QPixmap>
 #include <QImageReader>
+#include <QThread>
+#include <QTimer>
+#include <QDateTime>
+#include <memory>
+#include "batch.h"
+#include "outputindex.h"
+#include "previewcache.h"
 
 using namespace std;
 
+class EncodedImageReader;
+
 class ImagePreviewLabel : public QLabel {
     Q_OBJECT
 
 public:
     ImagePreviewLabel(QWidget *parent = nullptr);
-    void setPixmap(const QString &imagePath);
+    // image may be a thumbnail of a larger image of fullSize
+    void setImage(const QImage &image, const QSize &fullSize = QSize());
+    // Zoomed-in views decode just the visible tiles of this .bin
+    void setCompressedSource(const QString &binPath);
 
 protected:
     void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
 
 private:
-    QPixmap originalPixmap;
+    QImage originalImage;
+    QString compressedSource;
+    // Kept open across zooms and pans, and across previews of the same
+    // unchanged file, so the index and decoder tables are read only once
+    shared_ptr<EncodedImageReader> reader;
+    QString readerPath;
+    QDateTime readerModified;
+    // Tiles are decoded once wheel and resize events stop arriving; until
+    // then the thumbnail is cropped instead
+    QTimer *regionTimer;
+    QRect decodedRegion;
+    QImage decodedView;
+    QSize imageSize;
+    double zoom;
+    QPointF center;  // Middle of the view as a fraction of the image size
     void updateScaledPixmap();
+    void decodeVisibleRegion();
+    QRect visibleRegion() const;
+};
+
+// Runs a BatchCompressor on its own thread and reports back through signals,
+// which arrive on the GUI thread as queued connections
+class BatchCompressionWorker : public QObject {
+    Q_OBJECT
+
+public:
+    // Sources unchanged since an earlier batch into outputDir reuse its outputs
+    BatchCompressionWorker(const vector<BatchJob> &jobs, const string &outputDir, QObject *parent = nullptr);
+    void cancel();
+
+public slots:
+    void run();
+
+signals:
+    // stats holds metadata table rows with the stage timings and counters;
+    // compressedPreview is the decoded side image and originalPreview a
+    // thumbnail of the source, whose full dimensions are imageSize
+    void fileFinished(const QString &imagePath, const QString &compressedImagePath, bool success,
+                      const QString &error, qint64 originalSize, qint64 compressedSize, const QString &stats,
+                      const QImage &compressedPreview, const QImage &originalPreview, const QSize &imageSize);
+    void finished(int successCount, int failCount, bool cancelled);
+
+private:
+    vector<BatchJob> jobs;
+    BatchCompressor compressor;
+    OutputIndex index;
 };
 
 class ImageCompressionGUI : public QWidget {
@@ -38,9 +98,13 @@ class ImageCompressionGUI : public QWidget {
 
 public:
     ImageCompressionGUI(QWidget *parent = nullptr);
+    ~ImageCompressionGUI();
 
 private:
     QMap<QString, QString> compressedFilePaths;
+    QMap<QString, QString> binFilePaths;
+    QMap<QString, QString> compressionStats;
+    PreviewCache previewCache;
     QLabel *metadataLabel;
     void updateMetadata(const QString &filePath = QString());
 
@@ -53,18 +117,31 @@ private slots:
     void handleBatchCompression();
     void removeSelectedFiles();
     void updateCompressionQuality(int value);
+    void updateQualityMode(int index);
     void updatePreview(QListWidgetItem *current);
     void showOriginalImage();
     void showCompressedImage();
+    void handleBatchFileFinished(const QString &imagePath, const QString &compressedImagePath, bool success,
+                                 const QString &error, qint64 originalSize, qint64 compressedSize,
+                                 const QString &stats, const QImage &compressedPreview,
+                                 const QImage &originalPreview, const QSize &imageSize);
+    void handleBatchFinished(int successCount, int failCount, bool cancelled);
 
 private:
     QLabel *statusLabel;
     QListWidget *fileListWidget;
     QSlider *qualitySlider;
     QLabel *qualityLabel;
+    QComboBox *qualityModeBox;      // Fixed quality or a target to search for
+    QDoubleSpinBox *qualityTargetBox;
     ImagePreviewLabel *previewLabel;
     QPushButton *originalImageBtn;
     QPushButton *compressedImageBtn;
+    QPushButton *compressButton;
+    QThread *batchThread;
+    BatchCompressionWorker *batchWorker;
+    int batchTotal;
+    int batchDone;
     
     int compressionQuality;
     QString lastCompressedImagePath;
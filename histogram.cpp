@@ -0,0 +1,55 @@
+#include "histogram.h"
+#include <cstring>
+
+using namespace std;
+
+// Consecutive bytes are spread over kTables sub-histograms so runs of equal
+// bytes don't serialise on a store-to-load dependency through one counter.
+static const unsigned kTables = 8;
+
+// 32-bit sub-counters are folded into the 64-bit result before they can wrap
+static const size_t kChunkSize = size_t(1) << 30;
+
+typedef uint32_t SubHistograms[kTables][256];
+
+static inline void countWord(SubHistograms &c, uint64_t w) {
+    c[0][w & 0xff]++;
+    c[1][(w >> 8) & 0xff]++;
+    c[2][(w >> 16) & 0xff]++;
+    c[3][(w >> 24) & 0xff]++;
+    c[4][(w >> 32) & 0xff]++;
+    c[5][(w >> 40) & 0xff]++;
+    c[6][(w >> 48) & 0xff]++;
+    c[7][w >> 56]++;
+}
+
+static void mergeSubHistograms(const SubHistograms &c, Histogram &freq) {
+    for (unsigned sym = 0; sym < 256; ++sym) {
+        uint64_t total = 0;
+        for (unsigned t = 0; t < kTables; ++t) total += c[t][sym];
+        freq[sym] += total;
+    }
+}
+
+static void countChunk(const uint8_t *data, size_t size, Histogram &freq) {
+    SubHistograms c = {};
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint64_t w0, w1;
+        memcpy(&w0, data + i, 8);
+        memcpy(&w1, data + i + 8, 8);
+        countWord(c, w0);
+        countWord(c, w1);
+    }
+    for (; i < size; ++i) c[0][data[i]]++;
+    mergeSubHistograms(c, freq);
+}
+
+void accumulateHistogram(const uint8_t *data, size_t size, Histogram &freq) {
+    while (size > 0) {
+        size_t n = size < kChunkSize ? size : kChunkSize;
+        countChunk(data, n, freq);
+        data += n;
+        size -= n;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Occurrence count per byte value
+typedef array<uint64_t, 256> Histogram;
+
+// Adds the byte counts of data[0, size) to freq
+void accumulateHistogram(const uint8_t *data, size_t size, Histogram &freq);
+
+#endif
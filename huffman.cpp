@@ -1,65 +1,575 @@
 #include "huffman.h"
-#include <functional>
+#include "bitstream.h"
+#include "bufferpool.h"
+#include <algorithm>
+#include <stdexcept>
 
 using namespace std;
 
-void buildHuffmanTree(const string &data, unordered_map<char, string> &codes, unordered_map<string, char> &reverseCodes, Node* &root) {
-    unordered_map<char, int> freq;
-    for (char ch : data) freq[ch]++;
-    
-    priority_queue<Node*, vector<Node*>, Compare> pq;
-    for (auto &[ch, f] : freq) pq.push(new Node(ch, f));
-    
-    while (pq.size() > 1) {
-        Node *left = pq.top(); pq.pop();
-        Node *right = pq.top(); pq.pop();
-        Node *parent = new Node('\0', left->freq + right->freq);
-        parent->left = left; parent->right = right;
-        pq.push(parent);
-    }
-    
-    root = pq.top();
-    function<void(Node*, string)> generateCodes = [&](Node* node, string str) {
-        if (!node) return;
-        if (node->data != '\0') {
-            codes[node->data] = str;
-            reverseCodes[str] = node->data;
+void countFrequencies(const PixelView &pixels, Histogram &freq) {
+    freq.fill(0);
+    forEachRun(pixels, [&](const uint8_t *run, size_t size) { accumulateHistogram(run, size, freq); });
+}
+
+// Symbols with a non-zero count, lightest first (ties by symbol value)
+static unsigned sortedSymbols(const Histogram &freq, unsigned symbols[256]) {
+    unsigned n = 0;
+    for (unsigned sym = 0; sym < 256; ++sym) {
+        if (freq[sym]) symbols[n++] = sym;
+    }
+    sort(symbols, symbols + n, [&](unsigned a, unsigned b) {
+        return freq[a] != freq[b] ? freq[a] < freq[b] : a < b;
+    });
+    return n;
+}
+
+static void checkCodeLengthLimit(unsigned maxCodeLength) {
+    if (maxCodeLength < kMinCodeLengthLimit || maxCodeLength > kMaxSupportedCodeLength) {
+        throw invalid_argument("Unsupported Huffman code length limit!");
+    }
+}
+
+// Moffat-Katajainen in-place Huffman: with the weights sorted ascending, the
+// array is reused first for internal node weights and parent pointers, then
+// for node depths, and finally holds each leaf's code length. No tree nodes
+// are ever allocated.
+static void minimumRedundancyLengths(uint64_t A[], unsigned n) {
+    // First pass, left to right: pair the two lightest items, storing parent indices
+    A[0] += A[1];
+    unsigned root = 0, leaf = 2;
+    for (unsigned next = 1; next < n - 1; ++next) {
+        if (leaf >= n || A[root] < A[leaf]) {
+            A[next] = A[root];
+            A[root++] = next;
+        } else {
+            A[next] = A[leaf++];
+        }
+        if (leaf >= n || (root < next && A[root] < A[leaf])) {
+            A[next] += A[root];
+            A[root++] = next;
+        } else {
+            A[next] += A[leaf++];
+        }
+    }
+
+    // Second pass, right to left: internal node depths
+    A[n - 2] = 0;
+    for (unsigned next = n - 2; next-- > 0;) A[next] = A[A[next]] + 1;
+
+    // Third pass, right to left: leaf depths
+    unsigned available = 1, used = 0, depth = 0;
+    int internal = int(n) - 2, next = int(n) - 1;
+    while (available > 0) {
+        while (internal >= 0 && A[internal] == depth) {
+            ++used;
+            --internal;
+        }
+        while (available > used) {
+            A[next--] = depth;
+            --available;
+        }
+        available = 2 * used;
+        ++depth;
+        used = 0;
+    }
+}
+
+CodeLengths buildCodeLengths(const Histogram &freq, unsigned maxCodeLength) {
+    checkCodeLengthLimit(maxCodeLength);
+
+    unsigned symbols[256];
+    unsigned n = sortedSymbols(freq, symbols);
+    CodeLengths lengths = {};
+    if (n == 0) return lengths;
+    if (n == 1) {
+        // A single-symbol input still needs a one-bit code
+        lengths[symbols[0]] = 1;
+        return lengths;
+    }
+
+    uint64_t work[256];
+    for (unsigned i = 0; i < n; ++i) work[i] = freq[symbols[i]];
+    minimumRedundancyLengths(work, n);
+
+    // Lightest symbol has the longest code. Skewed histograms can produce
+    // very deep trees; recompute within the cap
+    if (work[0] > maxCodeLength) return limitedCodeLengths(freq, maxCodeLength);
+    for (unsigned i = 0; i < n; ++i) lengths[symbols[i]] = uint8_t(work[i]);
+    return lengths;
+}
+
+// Package-merge: optimal code lengths subject to a maximum length. Each of
+// the maxCodeLength levels merges the sorted leaves with pairs ("packages")
+// of the level below; the cheapest 2n-2 items of the top level, expanded back
+// down, give each symbol one bit of length per level it appears in.
+CodeLengths limitedCodeLengths(const Histogram &freq, unsigned maxCodeLength) {
+    checkCodeLengthLimit(maxCodeLength);
+
+    unsigned symbols[256];
+    unsigned n = sortedSymbols(freq, symbols);
+    CodeLengths lengths = {};
+    if (n == 0) return lengths;
+    if (n == 1) {
+        lengths[symbols[0]] = 1;
+        return lengths;
+    }
+
+    const unsigned kMaxItems = 2 * 256;
+    bool isLeaf[kMaxSupportedCodeLength][kMaxItems];
+    unsigned listSize[kMaxSupportedCodeLength];
+    uint64_t weights[kMaxItems], merged[kMaxItems];
+
+    // Deepest level: just the leaves
+    for (unsigned i = 0; i < n; ++i) {
+        weights[i] = freq[symbols[i]];
+        isLeaf[0][i] = true;
+    }
+    listSize[0] = n;
+
+    for (unsigned level = 1; level < maxCodeLength; ++level) {
+        unsigned packages = listSize[level - 1] / 2;
+        unsigned leaf = 0, pkg = 0, size = 0;
+        while (leaf < n || pkg < packages) {
+            uint64_t pkgWeight = pkg < packages ? weights[2 * pkg] + weights[2 * pkg + 1] : 0;
+            bool takeLeaf = pkg >= packages || (leaf < n && freq[symbols[leaf]] <= pkgWeight);
+            if (takeLeaf) {
+                merged[size] = freq[symbols[leaf++]];
+            } else {
+                merged[size] = pkgWeight;
+                ++pkg;
+            }
+            isLeaf[level][size++] = takeLeaf;
         }
-        generateCodes(node->left, str + "0");
-        generateCodes(node->right, str + "1");
+        copy(merged, merged + size, weights);
+        listSize[level] = size;
+    }
+
+    // Expand the selected items: leaves found in a level's prefix are always
+    // the lightest symbols, and its packages select twice as many items below
+    unsigned selected = 2 * n - 2;
+    for (unsigned level = maxCodeLength; level-- > 0;) {
+        unsigned leaves = 0;
+        for (unsigned i = 0; i < selected; ++i) leaves += isLeaf[level][i];
+        for (unsigned i = 0; i < leaves; ++i) lengths[symbols[i]]++;
+        selected = 2 * (selected - leaves);
+    }
+    return lengths;
+}
+
+// Canonical order: shorter codes first, ties broken by symbol value, found
+// by counting codes per length as in deflate. Returns false if the lengths
+// over-subscribe the code space.
+static bool assignCanonical(const CodeLengths &lengths, uint32_t values[256]) {
+    unsigned lengthCount[kMaxSupportedCodeLength + 1] = {};
+    for (uint8_t length : lengths) {
+        if (length > kMaxSupportedCodeLength) return false;
+        lengthCount[length]++;
+    }
+    lengthCount[0] = 0;
+
+    uint64_t nextCode[kMaxSupportedCodeLength + 1] = {};
+    uint64_t code = 0;
+    for (unsigned length = 1; length <= kMaxSupportedCodeLength; ++length) {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
+        if (code + lengthCount[length] > (uint64_t(1) << length)) return false;
+    }
+    for (unsigned sym = 0; sym < 256; ++sym) {
+        if (lengths[sym]) values[sym] = uint32_t(nextCode[lengths[sym]]++);
+    }
+    return true;
+}
+
+CodeTable canonicalCodes(const CodeLengths &lengths) {
+    uint32_t values[256];
+    if (!assignCanonical(lengths, values)) {
+        throw runtime_error("Invalid Huffman code lengths!");
+    }
+    CodeTable codes = {};
+    for (unsigned sym = 0; sym < 256; ++sym) {
+        if (lengths[sym]) codes[sym] = {values[sym], lengths[sym]};
+    }
+    return codes;
+}
+
+// Bits needed to code freq with the given lengths, UINT64_MAX if a symbol
+// that occurs has no code
+uint64_t codedBits(const Histogram &freq, const CodeLengths &lengths) {
+    uint64_t bits = 0;
+    for (unsigned sym = 0; sym < 256; ++sym) {
+        if (freq[sym] == 0) continue;
+        if (lengths[sym] == 0) return UINT64_MAX;
+        bits += freq[sym] * lengths[sym];
+    }
+    return bits;
+}
+
+// Bits a stored table costs in the .bin header
+static const uint64_t kTableBits = 256 * 8;
+static const unsigned kTableSetPasses = 4;
+
+static Histogram sumHistograms(const Histogram *freqs, size_t count, const vector<uint8_t> &selectors, unsigned table) {
+    Histogram sum = {};
+    for (size_t i = 0; i < count; ++i) {
+        if (selectors[i] != table) continue;
+        for (unsigned sym = 0; sym < 256; ++sym) sum[sym] += freqs[i][sym];
+    }
+    return sum;
+}
+
+// bzip2-style table selection. The histograms (one per tile) start out split
+// into maxTables groups by how well the shared table codes them; each pass
+// rebuilds one table per group and moves every tile to the table that codes
+// it in the fewest bits. Tables are only kept when they pay for their header
+// space, so uniform images end up with the single shared table.
+vector<CodeLengths> buildCodeTableSet(const Histogram *freqs, size_t count, unsigned maxTables,
+                                      vector<uint8_t> &selectors, unsigned maxCodeLength) {
+    if (maxTables == 0 || maxTables > 256) {
+        throw invalid_argument("Table count must be between 1 and 256!");
+    }
+    selectors.assign(count, 0);
+    Histogram total = sumHistograms(freqs, count, selectors, 0);
+    CodeLengths shared = buildCodeLengths(total, maxCodeLength);
+    unsigned tables = unsigned(min<size_t>(maxTables, count));
+    if (tables <= 1) return {shared};
+    uint64_t sharedBits = codedBits(total, shared) + kTableBits;
+
+    // Initial groups: equal-sized runs of tiles ordered by bits per byte
+    // under the shared table
+    vector<pair<double, size_t>> order(count);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t bytes = 0;
+        for (unsigned sym = 0; sym < 256; ++sym) bytes += freqs[i][sym];
+        order[i] = {bytes ? double(codedBits(freqs[i], shared)) / bytes : 0.0, i};
+    }
+    sort(order.begin(), order.end());
+    for (size_t i = 0; i < count; ++i) selectors[order[i].second] = uint8_t(i * tables / count);
+
+    vector<CodeLengths> set(tables);
+    for (unsigned pass = 0; pass < kTableSetPasses; ++pass) {
+        // While refining, every symbol of the image gets a code in every
+        // table so any tile can move to any table
+        for (unsigned t = 0; t < tables; ++t) {
+            Histogram sum = sumHistograms(freqs, count, selectors, t);
+            for (unsigned sym = 0; sym < 256; ++sym) {
+                if (total[sym] && !sum[sym]) sum[sym] = 1;
+            }
+            set[t] = buildCodeLengths(sum, maxCodeLength);
+        }
+        bool moved = false;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t best = UINT64_MAX;
+            uint8_t choice = selectors[i];
+            for (unsigned t = 0; t < tables; ++t) {
+                uint64_t bits = codedBits(freqs[i], set[t]);
+                if (bits < best) {
+                    best = bits;
+                    choice = uint8_t(t);
+                }
+            }
+            moved |= choice != selectors[i];
+            selectors[i] = choice;
+        }
+        if (!moved) break;
+    }
+
+    // Final tables cover exactly the tiles assigned to them; empty groups
+    // are dropped and the selectors renumbered
+    vector<CodeLengths> result;
+    vector<uint8_t> remap(tables, 0);
+    uint64_t bits = 0;
+    for (unsigned t = 0; t < tables; ++t) {
+        Histogram sum = sumHistograms(freqs, count, selectors, t);
+        if (all_of(sum.begin(), sum.end(), [](uint64_t n) { return n == 0; })) continue;
+        remap[t] = uint8_t(result.size());
+        result.push_back(buildCodeLengths(sum, maxCodeLength));
+        bits += codedBits(sum, result.back()) + kTableBits;
+    }
+    if (result.size() <= 1 || bits >= sharedBits) {
+        selectors.assign(count, 0);
+        return {shared};
+    }
+    for (uint8_t &sel : selectors) sel = remap[sel];
+    return result;
+}
+
+void encode(const PixelView &pixels, const CodeTable &codes, vector<uint8_t> &out, uint64_t &bitCount) {
+    out.reserve(out.size() + pixels.size() + 8);
+    BitWriter writer(out);
+    forEachRun(pixels, [&](const uint8_t *run, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            const HuffmanCode &code = codes[run[i]];
+            writer.writeBits(code.bits, code.length);
+        }
+    });
+    bitCount = writer.finish();
+}
+
+vector<uint8_t> encode(const PixelView &pixels, const CodeTable &codes, uint64_t &bitCount) {
+    vector<uint8_t> out;
+    encode(pixels, codes, out, bitCount);
+    return out;
+}
+
+// Symbols in substream k of an interleaved stream of count symbols
+static size_t segmentLength(size_t count, unsigned k) {
+    size_t segment = (count + kSubstreams - 1) / kSubstreams;
+    return min(count, (k + 1) * segment) - min(count, k * segment);
+}
+
+bool fitsInterleaved(size_t count, unsigned maxCodeLength) {
+    size_t segment = (count + kSubstreams - 1) / kSubstreams;
+    return segment <= (size_t(0xffff) * 8) / maxCodeLength;
+}
+
+void encodeInterleaved(const PixelView &pixels, const CodeTable &codes, vector<uint8_t> &out, uint64_t &bitCount) {
+    size_t count = pixels.size(), segment = (count + kSubstreams - 1) / kSubstreams;
+    size_t base = out.size();
+    out.reserve(base + kJumpTableSize + count + 8 * kSubstreams);
+    out.resize(base + kJumpTableSize);
+
+    // Segments are contiguous, so the substreams are written one after
+    // another into out; a run that crosses a boundary is split there
+    size_t index = 0, partStart = out.size();
+    unsigned k = 0;
+    BitWriter writer(out);
+    auto endPart = [&] {
+        writer.finish();
+        size_t partBytes = out.size() - partStart;
+        if (partBytes > 0xffff) {
+            throw invalid_argument("Block too large for interleaved coding!");
+        }
+        out[base + 2 * k] = uint8_t(partBytes);
+        out[base + 2 * k + 1] = uint8_t(partBytes >> 8);
+        partStart = out.size();
+        ++k;
     };
-    generateCodes(root, "");
+    forEachRun(pixels, [&](const uint8_t *run, size_t size) {
+        while (size > 0) {
+            while (index == (k + 1) * segment) endPart();
+            size_t n = min(size, (k + 1) * segment - index);
+            for (size_t i = 0; i < n; ++i) {
+                const HuffmanCode &code = codes[run[i]];
+                writer.writeBits(code.bits, code.length);
+            }
+            run += n;
+            size -= n;
+            index += n;
+        }
+    });
+    while (k + 1 < kSubstreams) endPart();
+    writer.finish();
+    bitCount = uint64_t(out.size() - base) * 8;
+}
+
+vector<uint8_t> encodeInterleaved(const PixelView &pixels, const CodeTable &codes, uint64_t &bitCount) {
+    vector<uint8_t> out;
+    encodeInterleaved(pixels, codes, out, bitCount);
+    return out;
 }
 
-void saveHuffmanCodes(const string &filePath, unordered_map<char, string> &codes) {
-    ofstream file(filePath);
-    for (auto &[ch, code] : codes) {
-        file << ch << " " << code << "\n";
+// Room for the root table and a few subtables, enough for most code sets
+static const size_t kTableReserve = (size_t(1) << HuffmanDecoder::kPrimaryBits) +
+                                    8 * (size_t(1) << HuffmanDecoder::kSecondaryBits);
+
+HuffmanDecoder::HuffmanDecoder(const CodeLengths &lengths, BufferPool *buffers) {
+    uint32_t values[256];
+    if (!assignCanonical(lengths, values)) {
+        throw runtime_error("Invalid Huffman code lengths!");
     }
-    file.close();
+    vector<Code> codes;
+    for (unsigned sym = 0; sym < 256; ++sym) {
+        if (lengths[sym]) codes.push_back({values[sym], lengths[sym], uint8_t(sym)});
+    }
+    if (buffers) table = buffers->acquireTable(kTableReserve);
+    table.resize(size_t(1) << kPrimaryBits);
+    fill(0, kPrimaryBits, codes, 0);
 }
 
-bool loadHuffmanCodes(const string &filePath, unordered_map<char, string> &codes, unordered_map<string, char> &reverseCodes) {
-    ifstream file(filePath);
-    if (!file) {
-        return false;
+void HuffmanDecoder::releaseTable(BufferPool *buffers) {
+    if (buffers) {
+        buffers->release(table);
+    } else {
+        vector<Entry>().swap(table);
     }
-    
-    char ch;
-    string code;
-    while (file >> ch >> code) {
-        codes[ch] = code;
-        reverseCodes[code] = ch;
+}
+
+void HuffmanDecoder::fill(size_t offset, unsigned bits, const vector<Code> &codes, unsigned depth) {
+    unordered_map<uint32_t, vector<Code>> longer;
+    for (const Code &code : codes) {
+        unsigned remaining = code.length - depth;
+        unsigned used = remaining < bits ? remaining : bits;
+        uint32_t prefix = uint32_t(code.value >> (remaining - used)) & ((uint32_t(1) << used) - 1);
+
+        if (remaining <= bits) {
+            // Every index that starts with this code resolves to the symbol
+            size_t first = offset + (size_t(prefix) << (bits - used));
+            size_t span = size_t(1) << (bits - used);
+            for (size_t i = 0; i < span; ++i) table[first + i] = {code.symbol, uint8_t(used), 0};
+        } else {
+            longer[prefix].push_back(code);
+        }
+    }
+
+    for (auto &[prefix, group] : longer) {
+        unsigned maxRemaining = 0;
+        for (const Code &code : group) maxRemaining = max(maxRemaining, code.length - depth - bits);
+        unsigned subBits = maxRemaining < kSecondaryBits ? maxRemaining : kSecondaryBits;
+
+        size_t subOffset = table.size();
+        table.resize(subOffset + (size_t(1) << subBits));
+        table[offset + prefix] = {uint32_t(subOffset), uint8_t(bits), uint8_t(subBits)};
+        fill(subOffset, subBits, group, depth + bits);
     }
-    file.close();
-    
-    return !codes.empty();
 }
 
-string encode(const string &data, unordered_map<char, string> &codes) {
-    string encodedStr;
-    for (char ch : data) {
-        encodedStr += codes[ch];
+void HuffmanDecoder::decode(BitReader &reader, uint8_t *out, size_t count) const {
+    // Work on local copies: stores through uint8_t* may alias anything, which
+    // would otherwise force the reader state back to memory on every symbol
+    BitReader bits = reader;
+    const Entry *root = table.data();
+    bool corrupt = false;
+
+    auto decodeOne = [&](size_t i) {
+        Entry e = root[bits.peekBits(kPrimaryBits)];
+        if (HUFFMAN_UNLIKELY(e.subBits)) {
+            do {
+                bits.skipBits(e.length);
+                if (bits.available() < e.subBits) bits.refill();
+                e = root[e.value + bits.peekBits(e.subBits)];
+            } while (e.subBits);
+            bits.skipBits(e.length);
+            bits.refill();
+        } else {
+            bits.skipBits(e.length);
+        }
+        corrupt |= (e.length == 0);
+        out[i] = static_cast<uint8_t>(e.value);
+    };
+
+    // A refill leaves at least 56 bits buffered, enough for four root-table
+    // codes; the rare subtable path refills on its own
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        bits.refill();
+        decodeOne(i);
+        decodeOne(i + 1);
+        decodeOne(i + 2);
+        decodeOne(i + 3);
+    }
+    for (; i < count; ++i) {
+        bits.refill();
+        decodeOne(i);
+    }
+
+    reader = bits;
+    if (corrupt) {
+        throw runtime_error("Corrupt Huffman stream!");
     }
-    return encodedStr;
-}
\ No newline at end of file
+}
+
+void HuffmanDecoder::decode(BitReader &reader, const MutablePixelView &out) const {
+    forEachRun(out, [&](uint8_t *run, size_t size) { decode(reader, run, size); });
+}
+
+void HuffmanDecoder::decodeInterleaved(const uint8_t *data, size_t size, uint8_t *out, size_t count) const {
+    if (size < kJumpTableSize) {
+        throw runtime_error("Corrupt Huffman stream!");
+    }
+    const uint8_t *starts[kSubstreams];
+    size_t sizes[kSubstreams];
+    size_t pos = kJumpTableSize;
+    for (unsigned k = 0; k + 1 < kSubstreams; ++k) {
+        sizes[k] = size_t(data[2 * k]) | size_t(data[2 * k + 1]) << 8;
+        starts[k] = data + pos;
+        pos += sizes[k];
+    }
+    if (pos > size) {
+        throw runtime_error("Corrupt Huffman stream!");
+    }
+    starts[kSubstreams - 1] = data + pos;
+    sizes[kSubstreams - 1] = size - pos;
+
+    // Local readers and output pointers, as in decode(); the four bit
+    // positions don't depend on each other, so their lookups overlap
+    BitReader r0(starts[0], sizes[0]), r1(starts[1], sizes[1]), r2(starts[2], sizes[2]), r3(starts[3], sizes[3]);
+    size_t segment = (count + kSubstreams - 1) / kSubstreams;
+    uint8_t *o0 = out, *o1 = out + min(count, segment), *o2 = out + min(count, 2 * segment);
+    uint8_t *o3 = out + min(count, 3 * segment);
+    const Entry *root = table.data();
+    bool corrupt = false;
+
+    auto decodeOne = [&](BitReader &bits) {
+        Entry e = root[bits.peekBits(kPrimaryBits)];
+        if (HUFFMAN_UNLIKELY(e.subBits)) {
+            do {
+                bits.skipBits(e.length);
+                if (bits.available() < e.subBits) bits.refill();
+                e = root[e.value + bits.peekBits(e.subBits)];
+            } while (e.subBits);
+            bits.skipBits(e.length);
+            bits.refill();
+        } else {
+            bits.skipBits(e.length);
+        }
+        corrupt |= (e.length == 0);
+        return static_cast<uint8_t>(e.value);
+    };
+
+    // The last segment is the shortest; all four advance together until it
+    // runs out, four symbols per reader per refill
+    size_t shared = segmentLength(count, kSubstreams - 1), i = 0;
+    for (; i + 4 <= shared; i += 4) {
+        r0.refill();
+        r1.refill();
+        r2.refill();
+        r3.refill();
+        for (unsigned j = 0; j < 4; ++j) {
+            o0[i + j] = decodeOne(r0);
+            o1[i + j] = decodeOne(r1);
+            o2[i + j] = decodeOne(r2);
+            o3[i + j] = decodeOne(r3);
+        }
+    }
+    for (; i < shared; ++i) {
+        r0.refill();
+        r1.refill();
+        r2.refill();
+        r3.refill();
+        o0[i] = decodeOne(r0);
+        o1[i] = decodeOne(r1);
+        o2[i] = decodeOne(r2);
+        o3[i] = decodeOne(r3);
+    }
+    BitReader *readers[3] = {&r0, &r1, &r2};
+    uint8_t *outs[3] = {o0, o1, o2};
+    for (unsigned k = 0; k < 3; ++k) {
+        for (size_t j = i; j < segmentLength(count, k); ++j) {
+            readers[k]->refill();
+            outs[k][j] = decodeOne(*readers[k]);
+        }
+    }
+
+    if (corrupt) {
+        throw runtime_error("Corrupt Huffman stream!");
+    }
+}
+
+void HuffmanDecoder::decodeInterleaved(const uint8_t *data, size_t size, const MutablePixelView &out) const {
+    if (out.isContinuous()) {
+        decodeInterleaved(data, size, out.data, out.size());
+        return;
+    }
+    // Segments cut across rows, so a strided target goes through scratch
+    vector<uint8_t> scratch(out.size());
+    decodeInterleaved(data, size, scratch.data(), scratch.size());
+    for (size_t y = 0; y < out.rows; ++y) memcpy(out.row(y), &scratch[y * out.rowBytes], out.rowBytes);
+}
+
+string decode(const vector<uint8_t> &encodedData, size_t symbolCount, const CodeLengths &lengths) {
+    HuffmanDecoder decoder(lengths);
+    BitReader reader(encodedData.data(), encodedData.size());
+    string decoded(symbolCount, '\0');
+    decoder.decode(reader, reinterpret_cast<uint8_t*>(&decoded[0]), symbolCount);
+    return decoded;
+}
@@ -2,30 +2,102 @@
 #define HUFFMAN_H
 
 #include <iostream>
-#include <queue>
 #include <unordered_map>
 #include <vector>
 #include <fstream>
+#include <cstdint>
+#include <array>
+#include "bitstream.h"
+#include "histogram.h"
+#include "pixelview.h"
 
 using namespace std;
 
-struct Node {
-    char data;
-    int freq;
-    Node *left, *right;
-    Node(char d, int f) : data(d), freq(f), left(nullptr), right(nullptr) {}
+class BufferPool;
+
+// Code length per byte value, 0 for unused symbols. Codes are canonical, so
+// the lengths alone are enough to rebuild both the encoder and decoder tables.
+typedef array<uint8_t, 256> CodeLengths;
+
+// Right-aligned code bits and their length, indexed by symbol
+struct HuffmanCode {
+    uint32_t bits;
+    uint8_t length;
 };
+typedef array<HuffmanCode, 256> CodeTable;
+
+// Default cap on code length. Keeping codes short bounds the decoder to a
+// root table plus one subtable level and lets the encoder emit any code
+// with a single fixed-width write.
+const unsigned kMaxCodeLength = 15;
+
+// Range accepted for the cap: 256 symbols need at least 8 bits, and
+// BitWriter::writeBits() takes at most 32
+const unsigned kMinCodeLengthLimit = 8;
+const unsigned kMaxSupportedCodeLength = 32;
+
+// Interleaved layout: the symbols are cut into kSubstreams contiguous
+// segments of ceil(count / 4), each coded as its own byte-aligned bitstream.
+// A jump table of kSubstreams - 1 little-endian u16 byte sizes comes first,
+// followed by the substreams. The decoder then runs one independent bit
+// reader per substream in the same loop.
+const unsigned kSubstreams = 4;
+const size_t kJumpTableSize = 2 * (kSubstreams - 1);
+
+// Whether count symbols with codes up to maxCodeLength bits always fit the
+// interleaved layout's 16-bit jump table
+bool fitsInterleaved(size_t count, unsigned maxCodeLength = kMaxCodeLength);
+
+// Table-driven decoder. The first kPrimaryBits of the stream index a root
+// table that resolves most symbols in one probe; longer codes follow a link
+// into a second-level table keyed on the following bits.
+class HuffmanDecoder {
+public:
+    static const unsigned kPrimaryBits = 11;
+    static const unsigned kSecondaryBits = 8;
+
+    // Leaf: value = symbol, length = bits consumed. Link: value = offset of
+    // the subtable, subBits = its index width. length == 0 marks an unused code.
+    struct Entry {
+        uint32_t value;
+        uint8_t length;
+        uint8_t subBits;
+    };
+
+    // The table is built in storage from buffers when it is given
+    explicit HuffmanDecoder(const CodeLengths &lengths, BufferPool *buffers = nullptr);
+    void decode(BitReader &reader, uint8_t *out, size_t count) const;
+    void decode(BitReader &reader, const MutablePixelView &out) const;
+    // Decodes a stream written by encodeInterleaved() holding count symbols
+    void decodeInterleaved(const uint8_t *data, size_t size, uint8_t *out, size_t count) const;
+    void decodeInterleaved(const uint8_t *data, size_t size, const MutablePixelView &out) const;
+    // Hands the table back to buffers; the decoder can't be used afterwards
+    void releaseTable(BufferPool *buffers);
+
+private:
+    struct Code {
+        uint64_t value;
+        unsigned length;
+        uint8_t symbol;
+    };
 
-struct Compare {
-    bool operator()(Node* l, Node* r) {
-        return l->freq > r->freq;
-    }
+    vector<Entry> table;
+    void fill(size_t offset, unsigned bits, const vector<Code> &codes, unsigned depth);
 };
 
-void buildHuffmanTree(const string &data, unordered_map<char, string> &codes, unordered_map<string, char> &reverseCodes, Node* &root);
-string encode(const string &data, unordered_map<char, string> &codes);
-string decode(const string &encodedData, unordered_map<string, char> &reverseCodes);
-void saveHuffmanCodes(const string &filePath, unordered_map<char, string> &codes);
-bool loadHuffmanCodes(const string &filePath, unordered_map<char, string> &codes, unordered_map<string, char> &reverseCodes);
+void countFrequencies(const PixelView &pixels, Histogram &freq);
+CodeLengths buildCodeLengths(const Histogram &freq, unsigned maxCodeLength = kMaxCodeLength);
+CodeLengths limitedCodeLengths(const Histogram &freq, unsigned maxCodeLength);
+CodeTable canonicalCodes(const CodeLengths &lengths);
+uint64_t codedBits(const Histogram &freq, const CodeLengths &lengths);
+vector<CodeLengths> buildCodeTableSet(const Histogram *freqs, size_t count, unsigned maxTables,
+                                      vector<uint8_t> &selectors, unsigned maxCodeLength = kMaxCodeLength);
+vector<uint8_t> encode(const PixelView &pixels, const CodeTable &codes, uint64_t &bitCount);
+// Interleaved layout; bitCount covers the jump table and all substreams
+vector<uint8_t> encodeInterleaved(const PixelView &pixels, const CodeTable &codes, uint64_t &bitCount);
+// Append to out instead, so a caller can hand in a recycled buffer
+void encode(const PixelView &pixels, const CodeTable &codes, vector<uint8_t> &out, uint64_t &bitCount);
+void encodeInterleaved(const PixelView &pixels, const CodeTable &codes, vector<uint8_t> &out, uint64_t &bitCount);
+string decode(const vector<uint8_t> &encodedData, size_t symbolCount, const CodeLengths &lengths);
 
 #endif
\ No newline at end of file
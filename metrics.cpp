@@ -0,0 +1,100 @@
+#include "metrics.h"
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+using namespace std;
+
+static const char *const kStageNames[kStageCount] = {
+    "imread", "extract", "histogram", "tree_build", "encode", "file_write", "image_write",
+};
+
+static const char *const kCounterNames[kCounterCount] = {"bytes_in", "bin_bytes", "image_bytes"};
+
+const char *stageName(Stage stage) {
+    return kStageNames[unsigned(stage)];
+}
+
+const char *counterName(Counter counter) {
+    return kCounterNames[unsigned(counter)];
+}
+
+string jsonString(const string &text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[7];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+CompressionStats::CompressionStats() : codedBits(0), symbols() {
+    for (atomic<uint64_t> &n : stageNanos) n = 0;
+    for (atomic<uint64_t> &n : counters) n = 0;
+}
+
+CompressionStats::CompressionStats(const CompressionStats &other) : CompressionStats() {
+    *this = other;
+}
+
+CompressionStats &CompressionStats::operator=(const CompressionStats &other) {
+    if (this == &other) return *this;
+    for (size_t i = 0; i < kStageCount; ++i) stageNanos[i] = other.stageNanos[i].load();
+    for (size_t i = 0; i < kCounterCount; ++i) counters[i] = other.counters[i].load();
+    codedBits = other.codedBits.load();
+    Histogram copy;
+    {
+        lock_guard<mutex> guard(other.symbolLock);
+        copy = other.symbols;
+    }
+    lock_guard<mutex> guard(symbolLock);
+    symbols = copy;
+    return *this;
+}
+
+void CompressionStats::addSymbols(const Histogram &freq) {
+    lock_guard<mutex> guard(symbolLock);
+    for (size_t i = 0; i < freq.size(); ++i) symbols[i] += freq[i];
+}
+
+double CompressionStats::entropy() const {
+    lock_guard<mutex> guard(symbolLock);
+    uint64_t total = 0;
+    for (uint64_t n : symbols) total += n;
+    double bits = 0;
+    for (uint64_t n : symbols) {
+        if (n > 0) bits -= double(n) * log2(double(n) / total);
+    }
+    return total ? bits / total : 0.0;
+}
+
+double CompressionStats::averageCodeLength() const {
+    lock_guard<mutex> guard(symbolLock);
+    uint64_t total = 0;
+    for (uint64_t n : symbols) total += n;
+    return total ? double(codedBits) / total : 0.0;
+}
+
+string CompressionStats::toJson() const {
+    ostringstream out;
+    out << "{\"seconds\": {";
+    for (size_t i = 0; i < kStageCount; ++i) {
+        out << (i ? ", " : "") << "\"" << kStageNames[i] << "\": " << seconds(Stage(i));
+    }
+    out << "}";
+    for (size_t i = 0; i < kCounterCount; ++i) out << ", \"" << kCounterNames[i] << "\": " << counters[i].load();
+    out << ", \"entropy\": " << entropy() << ", \"avg_code_length\": " << averageCodeLength() << "}";
+    return out.str();
+}
@@ -0,0 +1,95 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include "histogram.h"
+
+using namespace std;
+
+// Pipeline stages timed for one image
+enum class Stage : unsigned {
+    Read,        // imread
+    Extract,     // Colour transform, prediction and plane split
+    Histogram,
+    TreeBuild,   // Code lengths and table clustering
+    Encode,      // Huffman coding
+    FileWrite,   // .bin output
+    ImageWrite,  // Side image encode and write
+};
+const size_t kStageCount = 7;
+
+enum class Counter : unsigned {
+    BytesIn,     // Raw pixel bytes
+    BinBytes,
+    ImageBytes,  // Side image
+};
+const size_t kCounterCount = 3;
+
+const char *stageName(Stage stage);
+const char *counterName(Counter counter);
+
+// text as a quoted JSON string, with quotes, backslashes and control
+// characters escaped
+string jsonString(const string &text);
+
+// Timings and counters for one image, safe to update from any thread.
+// Stages that run on the pool add up the time of every task, so they can
+// exceed the wall time. Code that is handed a null CompressionStats pointer
+// records nothing and never reads the clock.
+class CompressionStats {
+public:
+    CompressionStats();
+    CompressionStats(const CompressionStats &other);
+    CompressionStats &operator=(const CompressionStats &other);
+
+    void addTime(Stage stage, uint64_t nanoseconds) { stageNanos[unsigned(stage)] += nanoseconds; }
+    void add(Counter counter, uint64_t value) { counters[unsigned(counter)] += value; }
+    // Bytes that went through the Huffman coder and the bits they became
+    void addSymbols(const Histogram &freq);
+    void addCodedBits(uint64_t bits) { codedBits += bits; }
+
+    double seconds(Stage stage) const { return stageNanos[unsigned(stage)] * 1e-9; }
+    uint64_t count(Counter counter) const { return counters[unsigned(counter)]; }
+    // Order-0 Shannon entropy of the coded bytes, in bits per byte
+    double entropy() const;
+    // Mean code length actually spent, in bits per byte
+    double averageCodeLength() const;
+
+    // One JSON object holding every stage time and counter
+    string toJson() const;
+
+private:
+    atomic<uint64_t> stageNanos[kStageCount];
+    atomic<uint64_t> counters[kCounterCount];
+    atomic<uint64_t> codedBits;
+    mutable mutex symbolLock;
+    Histogram symbols;
+};
+
+// Adds the time between construction and destruction to a stage
+class ScopedTimer {
+public:
+    ScopedTimer(CompressionStats *stats, Stage stage) : stats(stats), stage(stage) {
+        if (stats) start = chrono::steady_clock::now();
+    }
+    ~ScopedTimer() {
+        if (stats) {
+            auto elapsed = chrono::steady_clock::now() - start;
+            stats->addTime(stage, uint64_t(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+        }
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    CompressionStats *stats;
+    Stage stage;
+    chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "outputindex.h"
+#include "compression.h"
+#include "xxhash.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Bump when the same source and settings would give different output
+static const unsigned kIndexVersion = 1;
+// First line of the file, naming its layout
+static const char kIndexHeader[] = "huffman-index 1";
+static const size_t kEntryFields = 10;
+
+// Absolute and without "." or "..", so one file is always spelled the same way
+static string normalPath(const string &path) {
+    error_code ec;
+    fs::path absolute = fs::absolute(path, ec);
+    return (ec ? fs::path(path) : absolute).lexically_normal().string();
+}
+
+// Size and modification time of path, false if it can't be read
+static bool fileStamp(const string &path, uint64_t &size, int64_t &time) {
+    error_code ec;
+    size = fs::file_size(path, ec);
+    if (ec) return false;
+    fs::file_time_type modified = fs::last_write_time(path, ec);
+    if (ec) return false;
+    time = int64_t(modified.time_since_epoch().count());
+    return true;
+}
+
+static bool unchanged(const string &path, uint64_t size, int64_t time) {
+    uint64_t actualSize;
+    int64_t actualTime;
+    return fileStamp(path, actualSize, actualTime) && actualSize == size && actualTime == time;
+}
+
+static bool entryUnchanged(const IndexEntry &entry) {
+    return unchanged(entry.outputPath + ".bin", entry.binSize, entry.binTime) &&
+           unchanged(entry.compressedImagePath, entry.imageSize, entry.imageTime);
+}
+
+// Makes to name the same file as from, replacing whatever it named before
+static bool linkFile(const string &from, const string &to) {
+    error_code ec;
+    if (fs::equivalent(from, to, ec)) return true;
+    fs::remove(to, ec);
+    fs::create_hard_link(from, to, ec);
+    if (!ec) return true;
+    return fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec) && !ec;
+}
+
+static vector<string> splitFields(const string &line) {
+    vector<string> fields;
+    size_t start = 0, tab;
+    while ((tab = line.find('\t', start)) != string::npos) {
+        fields.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+    fields.push_back(line.substr(start));
+    return fields;
+}
+
+OutputIndex::OutputIndex(const string &path) : indexPath(path) {
+    ifstream in(path);
+    string line;
+    if (!getline(in, line) || line != kIndexHeader) return;
+    while (getline(in, line)) {
+        vector<string> fields = splitFields(line);
+        if (fields.size() != kEntryFields) continue;
+        char *end = nullptr;
+        uint64_t key = strtoull(fields[0].c_str(), &end, 16);
+        if (fields[0].empty() || *end != '\0') continue;
+        IndexEntry entry = {fields[1], fields[2],
+                            strtoull(fields[3].c_str(), nullptr, 10), strtoll(fields[4].c_str(), nullptr, 10),
+                            strtoull(fields[5].c_str(), nullptr, 10), strtoll(fields[6].c_str(), nullptr, 10),
+                            uint32_t(strtoul(fields[7].c_str(), nullptr, 10)),
+                            uint32_t(strtoul(fields[8].c_str(), nullptr, 10)),
+                            int(strtol(fields[9].c_str(), nullptr, 10))};
+        // restore() relies on the side image sitting next to the .bin
+        if (entry.compressedImagePath.compare(0, entry.outputPath.size(), entry.outputPath) != 0) continue;
+        entries[key] = entry;
+    }
+}
+
+uint64_t OutputIndex::key(const vector<uint8_t> &source, const BatchJob &job) {
+    // Everything besides the source that changes what gets written
+    string settings = to_string(kIndexVersion) + " " + job.imageFormat;
+    for (int param : job.compressionParams) settings += " " + to_string(param);
+    if (job.target.goal != QualityGoal::Fixed) {
+        uint64_t value;
+        memcpy(&value, &job.target.value, sizeof(value));
+        settings += " " + to_string(int(job.target.goal)) + " " + to_string(value);
+    }
+    uint64_t content = xxh64(source.data(), source.size());
+    return xxh64(reinterpret_cast<const uint8_t *>(settings.data()), settings.size(), content);
+}
+
+bool OutputIndex::lookup(uint64_t key, IndexEntry &entry) const {
+    {
+        lock_guard<mutex> guard(lock);
+        auto found = entries.find(key);
+        if (found == entries.end()) return false;
+        entry = found->second;
+    }
+    return entryUnchanged(entry);
+}
+
+bool OutputIndex::restore(uint64_t key, const string &outputPath, IndexEntry &entry,
+                          string &compressedImagePath) const {
+    // Held while linking, so release() can't unlink the files in between
+    lock_guard<mutex> guard(lock);
+    auto found = entries.find(key);
+    if (found == entries.end() || !entryUnchanged(found->second)) return false;
+    entry = found->second;
+    // The side image keeps its suffix, e.g. "_compressed.jpg"
+    compressedImagePath = outputPath + entry.compressedImagePath.substr(entry.outputPath.size());
+    if (normalPath(outputPath) == entry.outputPath) return true;
+    if (!linkFile(entry.outputPath + ".bin", outputPath + ".bin") ||
+        !linkFile(entry.compressedImagePath, compressedImagePath)) {
+        throw runtime_error("Error reusing compressed output!");
+    }
+    return true;
+}
+
+void OutputIndex::release(const string &outputPath, const string &imageFormat) {
+    string base = normalPath(outputPath);
+    lock_guard<mutex> guard(lock);
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.outputPath == base) {
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    error_code ec;
+    fs::remove(outputPath + ".bin", ec);
+    fs::remove(sideImagePath(outputPath, imageFormat), ec);
+}
+
+void OutputIndex::record(uint64_t key, const string &outputPath, const BatchResult &result) {
+    IndexEntry entry = {normalPath(outputPath), normalPath(result.compressedImagePath), 0, 0, 0, 0,
+                        result.width, result.height, result.imageQuality};
+    if (!fileStamp(outputPath + ".bin", entry.binSize, entry.binTime) ||
+        !fileStamp(result.compressedImagePath, entry.imageSize, entry.imageTime)) {
+        return;
+    }
+    lock_guard<mutex> guard(lock);
+    entries[key] = entry;
+}
+
+void OutputIndex::clear() {
+    lock_guard<mutex> guard(lock);
+    entries.clear();
+}
+
+bool OutputIndex::save() const {
+    lock_guard<mutex> guard(lock);
+    // Written aside and renamed over the old index, so a crash leaves one or the other
+    string tempPath = indexPath + ".tmp";
+    ofstream out(tempPath, ios::trunc);
+    out << kIndexHeader << "\n";
+    for (const auto &item : entries) {
+        const IndexEntry &entry = item.second;
+        if (entry.outputPath.find_first_of("\t\n") != string::npos ||
+            entry.compressedImagePath.find_first_of("\t\n") != string::npos || !entryUnchanged(entry)) {
+            continue;
+        }
+        char key[17];
+        snprintf(key, sizeof(key), "%016llx", (unsigned long long)item.first);
+        out << key << "\t" << entry.outputPath << "\t" << entry.compressedImagePath << "\t"
+            << entry.binSize << "\t" << entry.binTime << "\t" << entry.imageSize << "\t" << entry.imageTime << "\t"
+            << entry.width << "\t" << entry.height << "\t" << entry.imageQuality << "\n";
+    }
+    out.close();
+    error_code ec;
+    if (out) fs::rename(tempPath, indexPath, ec);
+    if (!out || ec) {
+        fs::remove(tempPath, ec);
+        return false;
+    }
+    return true;
+}
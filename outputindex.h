@@ -0,0 +1,80 @@
+#ifndef OUTPUTINDEX_H
+#define OUTPUTINDEX_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "batch.h"
+
+using namespace std;
+
+// File an output directory's index is kept in
+const char kOutputIndexName[] = ".huffman-index";
+
+// One set of outputs on disk, with the size and modification time (in file
+// clock ticks) each file had when it was written
+struct IndexEntry {
+    string outputPath;  // Base path, as in BatchJob
+    string compressedImagePath;
+    uint64_t binSize;
+    int64_t binTime;
+    uint64_t imageSize;
+    int64_t imageTime;
+    uint32_t width;
+    uint32_t height;
+    int imageQuality;
+};
+
+// Persistent map from what an output is made of, the source's bytes and the
+// settings, to an output already written from them. Batch runs use it to
+// skip sources they have compressed before, and to give byte-identical
+// sources one set of files that the others are linked to. An entry is only
+// trusted while its files keep the size and time they were recorded with.
+// Safe to use from any thread.
+class OutputIndex {
+public:
+    // Loads the index at path; a missing or unreadable one starts out empty
+    explicit OutputIndex(const string &path);
+
+    OutputIndex(const OutputIndex &) = delete;
+    OutputIndex &operator=(const OutputIndex &) = delete;
+
+    // XXH64 of the source's bytes, seeded into a hash of job's settings
+    static uint64_t key(const vector<uint8_t> &source, const BatchJob &job);
+
+    // Finds key's entry, if it has one whose files are unchanged
+    bool lookup(uint64_t key, IndexEntry &entry) const;
+
+    // Makes the files of key's entry appear under outputPath as well, as
+    // hard links or, where linking fails, copies, and sets compressedImagePath
+    // to the side image there. The entry is checked again as it is linked,
+    // since it may have been rewritten since lookup(); false if it no longer
+    // holds.
+    bool restore(uint64_t key, const string &outputPath, IndexEntry &entry, string &compressedImagePath) const;
+
+    // Call before rewriting outputPath's files: drops the entries for them
+    // and unlinks them. The writers replace files rather than writing
+    // through them either way, so names linked to them keep their contents.
+    void release(const string &outputPath, const string &imageFormat);
+
+    // Records the files result just wrote under outputPath as key's entry
+    void record(uint64_t key, const string &outputPath, const BatchResult &result);
+
+    // Forgets every entry, so the next run compresses everything again
+    void clear();
+
+    // Writes the index back to its file, leaving out entries whose files
+    // have changed since. False if it could not be written.
+    bool save() const;
+
+    const string &path() const { return indexPath; }
+
+private:
+    string indexPath;
+    mutable mutex lock;
+    unordered_map<uint64_t, IndexEntry> entries;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef PIXELVIEW_H
+#define PIXELVIEW_H
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Read-only view of a 2D byte buffer: `rows` rows of `rowBytes` bytes each,
+// with consecutive rows starting `stride` bytes apart. Lets the coder walk
+// a cv::Mat (or any padded image buffer) in place without copying it.
+struct PixelView {
+    const uint8_t *data;
+    size_t rowBytes;
+    size_t rows;
+    size_t stride;
+
+    size_t size() const { return rowBytes * rows; }
+    bool isContinuous() const { return stride == rowBytes || rows <= 1; }
+    const uint8_t *row(size_t y) const { return data + y * stride; }
+};
+
+// Writable counterpart used as a decode target
+struct MutablePixelView {
+    uint8_t *data;
+    size_t rowBytes;
+    size_t rows;
+    size_t stride;
+
+    size_t size() const { return rowBytes * rows; }
+    bool isContinuous() const { return stride == rowBytes || rows <= 1; }
+    uint8_t *row(size_t y) const { return data + y * stride; }
+};
+
+inline PixelView bytesView(const uint8_t *data, size_t size) {
+    return {data, size, 1, size};
+}
+
+// Calls fn(ptr, length) for each contiguous run of the view. A continuous
+// view is handed over as one run so inner loops never see row boundaries.
+template <class View, class Fn>
+void forEachRun(const View &view, Fn fn) {
+    if (view.isContinuous()) {
+        if (view.size() > 0) fn(view.data, view.size());
+        return;
+    }
+    for (size_t y = 0; y < view.rows; ++y) fn(view.row(y), view.rowBytes);
+}
+
+#endif
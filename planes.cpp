@@ -0,0 +1,136 @@
+#include "planes.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PLANES_HAVE_SSSE3 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+void deinterleaveScalar(const uint8_t *src, size_t pixels, unsigned channels, uint8_t *const planes[]) {
+    for (size_t i = 0; i < pixels; ++i, src += channels) {
+        for (unsigned c = 0; c < channels; ++c) planes[c][i] = src[c];
+    }
+}
+
+static void interleaveScalar(const uint8_t *const planes[], size_t pixels, unsigned channels, uint8_t *dst) {
+    for (size_t i = 0; i < pixels; ++i, dst += channels) {
+        for (unsigned c = 0; c < channels; ++c) dst[c] = planes[c][i];
+    }
+}
+
+#ifdef PLANES_HAVE_SSSE3
+// 16 pixels per iteration: C interleaved vectors in, one vector per plane
+// out. Byte k of plane p sits at byte 16 * s + k' of source vector s, so
+// each plane is the OR of C pshufb results with the other bytes zeroed
+// (mask byte 0x80). The masks are built once per channel count.
+template <unsigned C>
+struct ShuffleMasks {
+    uint8_t split[C][C][16];  // [plane][source vector]
+    uint8_t merge[C][C][16];  // [destination vector][plane]
+
+    ShuffleMasks() {
+        for (unsigned p = 0; p < C; ++p) {
+            for (unsigned s = 0; s < C; ++s) {
+                for (unsigned k = 0; k < 16; ++k) {
+                    unsigned pos = k * C + p;
+                    split[p][s][k] = pos / 16 == s ? uint8_t(pos % 16) : 0x80;
+                    unsigned out = 16 * s + k;
+                    merge[s][p][k] = out % C == p ? uint8_t(out / C) : 0x80;
+                }
+            }
+        }
+    }
+};
+
+template <unsigned C>
+__attribute__((target("ssse3")))
+static void deinterleaveSsse3(const uint8_t *src, size_t pixels, uint8_t *const planes[]) {
+    static const ShuffleMasks<C> masks;
+    __m128i split[C][C];
+    for (unsigned p = 0; p < C; ++p) {
+        for (unsigned s = 0; s < C; ++s) split[p][s] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks.split[p][s]));
+    }
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i v[C];
+        for (unsigned s = 0; s < C; ++s) v[s] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * C + 16 * s));
+        for (unsigned p = 0; p < C; ++p) {
+            __m128i r = _mm_shuffle_epi8(v[0], split[p][0]);
+            for (unsigned s = 1; s < C; ++s) r = _mm_or_si128(r, _mm_shuffle_epi8(v[s], split[p][s]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[p] + i), r);
+        }
+    }
+    uint8_t *const rest[kMaxPlanes] = {planes[0] + i, planes[1] + i, C > 2 ? planes[2] + i : nullptr, C > 3 ? planes[3] + i : nullptr};
+    deinterleaveScalar(src + i * C, pixels - i, C, rest);
+}
+
+template <unsigned C>
+__attribute__((target("ssse3")))
+static void interleaveSsse3(const uint8_t *const planes[], size_t pixels, uint8_t *dst) {
+    static const ShuffleMasks<C> masks;
+    __m128i merge[C][C];
+    for (unsigned s = 0; s < C; ++s) {
+        for (unsigned p = 0; p < C; ++p) merge[s][p] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks.merge[s][p]));
+    }
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i v[C];
+        for (unsigned p = 0; p < C; ++p) v[p] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[p] + i));
+        for (unsigned s = 0; s < C; ++s) {
+            __m128i r = _mm_shuffle_epi8(v[0], merge[s][0]);
+            for (unsigned p = 1; p < C; ++p) r = _mm_or_si128(r, _mm_shuffle_epi8(v[p], merge[s][p]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * C + 16 * s), r);
+        }
+    }
+    const uint8_t *const rest[kMaxPlanes] = {planes[0] + i, planes[1] + i, C > 2 ? planes[2] + i : nullptr, C > 3 ? planes[3] + i : nullptr};
+    interleaveScalar(rest, pixels - i, C, dst + i * C);
+}
+#endif
+
+typedef void (*SplitKernel)(const uint8_t *, size_t, unsigned, uint8_t *const[]);
+typedef void (*MergeKernel)(const uint8_t *const[], size_t, unsigned, uint8_t *);
+
+#ifdef PLANES_HAVE_SSSE3
+static void deinterleaveSimd(const uint8_t *src, size_t pixels, unsigned channels, uint8_t *const planes[]) {
+    switch (channels) {
+    case 2: deinterleaveSsse3<2>(src, pixels, planes); break;
+    case 3: deinterleaveSsse3<3>(src, pixels, planes); break;
+    case 4: deinterleaveSsse3<4>(src, pixels, planes); break;
+    default: deinterleaveScalar(src, pixels, channels, planes); break;
+    }
+}
+
+static void interleaveSimd(const uint8_t *const planes[], size_t pixels, unsigned channels, uint8_t *dst) {
+    switch (channels) {
+    case 2: interleaveSsse3<2>(planes, pixels, dst); break;
+    case 3: interleaveSsse3<3>(planes, pixels, dst); break;
+    case 4: interleaveSsse3<4>(planes, pixels, dst); break;
+    default: interleaveScalar(planes, pixels, channels, dst); break;
+    }
+}
+#endif
+
+static SplitKernel selectSplitKernel() {
+#ifdef PLANES_HAVE_SSSE3
+    if (__builtin_cpu_supports("ssse3")) return deinterleaveSimd;
+#endif
+    return deinterleaveScalar;
+}
+
+static MergeKernel selectMergeKernel() {
+#ifdef PLANES_HAVE_SSSE3
+    if (__builtin_cpu_supports("ssse3")) return interleaveSimd;
+#endif
+    return interleaveScalar;
+}
+
+void deinterleave(const uint8_t *src, size_t pixels, unsigned channels, uint8_t *const planes[]) {
+    static const SplitKernel kernel = selectSplitKernel();
+    kernel(src, pixels, channels, planes);
+}
+
+void interleave(const uint8_t *const planes[], size_t pixels, unsigned channels, uint8_t *dst) {
+    static const MergeKernel kernel = selectMergeKernel();
+    kernel(planes, pixels, channels, dst);
+}
@@ -0,0 +1,21 @@
+#ifndef PLANES_H
+#define PLANES_H
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+const unsigned kMaxPlanes = 4;
+
+// Splits `pixels` interleaved pixels of `channels` bytes (1-4) into one
+// plane per channel. Picks the fastest kernel the CPU supports on first use.
+void deinterleave(const uint8_t *src, size_t pixels, unsigned channels, uint8_t *const planes[]);
+
+// Inverse of deinterleave()
+void interleave(const uint8_t *const planes[], size_t pixels, unsigned channels, uint8_t *dst);
+
+// Plain C++ deinterleave(), timed against it by the bench's planes_scalar stage
+void deinterleaveScalar(const uint8_t *src, size_t pixels, unsigned channels, uint8_t *const planes[]);
+
+#endif
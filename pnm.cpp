@@ -0,0 +1,59 @@
+#include "pnm.h"
+#include <cctype>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+// Next whitespace-separated header number, skipping # comments
+static bool readHeaderNumber(istream &in, uint32_t &value) {
+    int c = in.get();
+    while (c != EOF && (isspace(c) || c == '#')) {
+        if (c == '#') {
+            while (c != EOF && c != '\n') c = in.get();
+        }
+        c = in.get();
+    }
+    if (c == EOF || !isdigit(c)) return false;
+    uint64_t v = 0;
+    while (c != EOF && isdigit(c)) {
+        v = v * 10 + (c - '0');
+        if (v > UINT32_MAX) return false;
+        c = in.get();
+    }
+    value = uint32_t(v);
+    // Exactly one whitespace byte separates the header from the pixels
+    return c != EOF && isspace(c);
+}
+
+PnmReader::PnmReader(const string &path) : in(path, ios::binary), cols(0), rows(0), planes(0), dataOffset(0) {
+    if (!in) {
+        throw runtime_error("Error loading image!");
+    }
+    char magic[2] = {};
+    in.read(magic, sizeof(magic));
+    if (magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6')) {
+        throw runtime_error("Unsupported image format!");
+    }
+    planes = magic[1] == '6' ? 3 : 1;
+    uint32_t maxValue = 0;
+    if (!readHeaderNumber(in, cols) || !readHeaderNumber(in, rows) || !readHeaderNumber(in, maxValue) ||
+        cols == 0 || rows == 0 || maxValue == 0 || maxValue > 255) {
+        throw runtime_error("Unsupported image format!");
+    }
+    dataOffset = in.tellg();
+}
+
+void PnmReader::readRows(size_t first, size_t count, uint8_t *out) {
+    if (first + count > rows) {
+        throw invalid_argument("Row range outside the image!");
+    }
+    size_t rowBytes = size_t(cols) * planes;
+    in.seekg(dataOffset + streamoff(first) * streamoff(rowBytes));
+    if (!in.read(reinterpret_cast<char*>(out), streamsize(rowBytes * count))) {
+        throw runtime_error("Error loading image!");
+    }
+    if (planes == 3) {
+        for (size_t i = 0; i < rowBytes * count; i += 3) swap(out[i], out[i + 2]);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef PNM_H
+#define PNM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+using namespace std;
+
+// Random-access row reader for binary 8-bit PGM (P5) and PPM (P6) files, so
+// images larger than memory can be read one strip at a time. Colour rows are
+// returned in OpenCV's BGR order.
+class PnmReader {
+public:
+    explicit PnmReader(const string &path);
+
+    uint32_t width() const { return cols; }
+    uint32_t height() const { return rows; }
+    uint32_t channels() const { return planes; }
+
+    // Reads rows [first, first + count) tightly packed into out
+    void readRows(size_t first, size_t count, uint8_t *out);
+
+private:
+    ifstream in;
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t planes;
+    streamoff dataOffset;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "previewcache.h"
+#include "compression.h"
+#include <QFileInfo>
+#include <QImageReader>
+
+static qint64 imageBytes(const QImage &image) {
+    return qint64(image.bytesPerLine()) * image.height();
+}
+
+QImage matToQImage(const cv::Mat &mat) {
+    switch (mat.channels()) {
+    case 1:
+        return QImage(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_Grayscale8).copy();
+    case 4:
+        return QImage(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_ARGB32).copy();
+    default:
+        return QImage(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_RGB888).rgbSwapped();
+    }
+}
+
+PreviewCache::PreviewCache(qint64 maxBytes) : bytes(0), maxBytes(maxBytes) {}
+
+bool PreviewCache::lookup(const QString &path, PreviewEntry &entry) {
+    auto found = index.find(path);
+    if (found == index.end()) return false;
+    QFileInfo info(path);
+    EntryList::iterator it = found.value();
+    if (!info.exists() || info.size() != it->second.fileSize || info.lastModified() != it->second.modified) {
+        remove(path);
+        return false;
+    }
+    entries.splice(entries.begin(), entries, it);
+    entry = it->second;
+    return true;
+}
+
+void PreviewCache::store(const QString &path, const PreviewEntry &entry) {
+    remove(path);
+    qint64 size = imageBytes(entry.image);
+    if (entry.image.isNull() || size > maxBytes) return;
+    entries.emplace_front(path, entry);
+    index.insert(path, entries.begin());
+    bytes += size;
+    while (bytes > maxBytes) {
+        QString oldest = entries.back().first;
+        remove(oldest);
+    }
+}
+
+PreviewEntry PreviewCache::load(const QString &path, const QString &binPath) {
+    PreviewEntry entry;
+    if (lookup(path, entry)) return entry;
+
+    QFileInfo info(path);
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+    entry.image = reader.read();
+    if (entry.image.isNull() && !binPath.isEmpty()) {
+        try {
+            entry.image = matToQImage(decompressImage(binPath.toStdString()));
+        } catch (const exception &) {
+        }
+    }
+    entry.fullSize = entry.image.size();
+    if (info.exists()) {
+        entry.fileSize = info.size();
+        entry.modified = info.lastModified();
+        store(path, entry);
+    }
+    return entry;
+}
+
+void PreviewCache::insert(const QString &path, const QImage &image, const QSize &fullSize) {
+    QFileInfo info(path);
+    if (!info.exists()) return;
+    PreviewEntry entry;
+    entry.image = image;
+    entry.fullSize = fullSize.isValid() ? fullSize : image.size();
+    entry.fileSize = info.size();
+    entry.modified = info.lastModified();
+    store(path, entry);
+}
+
+void PreviewCache::remove(const QString &path) {
+    auto found = index.find(path);
+    if (found == index.end()) return;
+    bytes -= imageBytes(found.value()->second.image);
+    entries.erase(found.value());
+    index.erase(found);
+}
+
+void PreviewCache::clear() {
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef PREVIEWCACHE_H
+#define PREVIEWCACHE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QImage>
+#include <QString>
+#include <list>
+
+using namespace std;
+
+namespace cv { class Mat; }
+
+// Copies 8-bit pixels in OpenCV's BGR/BGRA order into a QImage
+QImage matToQImage(const cv::Mat &mat);
+
+// Default memory budget for decoded previews
+const qint64 kDefaultPreviewCacheBytes = 256 * 1024 * 1024;
+
+// Longest side of the source thumbnails the compressor hands back
+const int kPreviewThumbnailSize = 1024;
+
+struct PreviewEntry {
+    QImage image;
+    QSize fullSize;  // Of the file's image; larger than image for a thumbnail
+    qint64 fileSize = 0;
+    QDateTime modified;
+};
+
+// Decoded preview images keyed by file path, evicted least recently used
+// first once their pixels exceed the byte budget. An entry only hits while
+// the file's size and modification time still match, so a file rewritten
+// on disk is decoded again. GUI thread only.
+class PreviewCache {
+public:
+    explicit PreviewCache(qint64 maxBytes = kDefaultPreviewCacheBytes);
+
+    // The image at path, decoded from disk on a miss. If the file can't be
+    // read but a .bin for it is given, the image is decoded from that.
+    // Returns a null entry image when neither works.
+    PreviewEntry load(const QString &path, const QString &binPath = QString());
+
+    // Adds an image already decoded elsewhere, e.g. from the compressor's
+    // in-memory output, against the file as it is on disk now. fullSize is
+    // the file's image size when image is a thumbnail of it.
+    void insert(const QString &path, const QImage &image, const QSize &fullSize = QSize());
+    void remove(const QString &path);
+    void clear();
+
+    qint64 byteCount() const { return bytes; }
+
+private:
+    typedef list<pair<QString, PreviewEntry>> EntryList;
+
+    bool lookup(const QString &path, PreviewEntry &entry);
+    void store(const QString &path, const PreviewEntry &entry);
+
+    EntryList entries;  // Most recently used first
+    QHash<QString, EntryList::iterator> index;
+    qint64 bytes;
+    qint64 maxBytes;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "quality.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+static const size_t kSsimWindow = 8;
+
+static void checkSameShape(const PixelView &a, const PixelView &b) {
+    if (a.rowBytes != b.rowBytes || a.rows != b.rows) {
+        throw invalid_argument("Images differ in size!");
+    }
+}
+
+double psnr(const PixelView &a, const PixelView &b) {
+    checkSameShape(a, b);
+    uint64_t squared = 0;
+    for (size_t y = 0; y < a.rows; ++y) {
+        const uint8_t *pa = a.row(y), *pb = b.row(y);
+        for (size_t x = 0; x < a.rowBytes; ++x) {
+            int d = int(pa[x]) - int(pb[x]);
+            squared += uint64_t(d * d);
+        }
+    }
+    if (squared == 0) return numeric_limits<double>::infinity();
+    double mse = double(squared) / double(a.size());
+    return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+double ssim(const PixelView &a, const PixelView &b, unsigned channels) {
+    checkSameShape(a, b);
+    if (channels == 0 || a.rowBytes % channels != 0) {
+        throw invalid_argument("Unsupported channel count!");
+    }
+    const double c1 = (0.01 * 255) * (0.01 * 255), c2 = (0.03 * 255) * (0.03 * 255);
+    size_t width = a.rowBytes / channels;
+    double total = 0;
+    size_t windows = 0;
+
+    // Windows at the right and bottom edges are cut short rather than dropped
+    for (size_t y = 0; y < a.rows; y += kSsimWindow) {
+        size_t h = min(kSsimWindow, a.rows - y);
+        for (size_t x = 0; x < width; x += kSsimWindow) {
+            size_t w = min(kSsimWindow, width - x);
+            for (unsigned c = 0; c < channels; ++c) {
+                uint64_t sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+                for (size_t dy = 0; dy < h; ++dy) {
+                    const uint8_t *pa = a.row(y + dy) + x * channels + c, *pb = b.row(y + dy) + x * channels + c;
+                    for (size_t dx = 0; dx < w; ++dx) {
+                        uint32_t va = pa[dx * channels], vb = pb[dx * channels];
+                        sa += va;
+                        sb += vb;
+                        saa += va * va;
+                        sbb += vb * vb;
+                        sab += va * vb;
+                    }
+                }
+                double n = double(w * h);
+                double ma = sa / n, mb = sb / n;
+                double va = saa / n - ma * ma, vb = sbb / n - mb * mb, cov = sab / n - ma * mb;
+                total += ((2 * ma * mb + c1) * (2 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+                windows++;
+            }
+        }
+    }
+    return windows ? total / windows : 1.0;
+}
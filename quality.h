@@ -0,0 +1,29 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <cstddef>
+#include "pixelview.h"
+
+using namespace std;
+
+// What the lossy side image's quality is chosen for. Fixed takes the quality
+// in the compression parameters as given; the others search for it.
+enum class QualityGoal : unsigned {
+    Fixed,
+    MaxBytes,  // Highest quality whose file is at most value bytes
+    MinSsim,   // Lowest quality with at least value SSIM, 0 to 1
+    MinPsnr,   // Lowest quality with at least value dB PSNR
+};
+
+struct QualityTarget {
+    QualityGoal goal = QualityGoal::Fixed;
+    double value = 0;
+};
+
+// Both compare images of the same size and layout byte by byte. PSNR is in
+// dB and infinite for identical images. SSIM is the mean over 8x8 windows
+// of each channel, 1 for identical images.
+double psnr(const PixelView &a, const PixelView &b);
+double ssim(const PixelView &a, const PixelView &b, unsigned channels);
+
+#endif
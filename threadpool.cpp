@@ -0,0 +1,97 @@
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned threadCount) : stopping(false) {
+    if (threadCount == 0) threadCount = thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread &worker : workers) worker.join();
+}
+
+void ThreadPool::submit(function<void()> task) {
+    {
+        lock_guard<mutex> guard(lock);
+        tasks.push(move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+    for (;;) {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;
+            task = move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const function<void(size_t)> &body) {
+    if (count == 0) return;
+    if (count == 1 || workers.empty()) {
+        for (size_t i = 0; i < count; ++i) body(i);
+        return;
+    }
+
+    // Helpers may still be queued after the loop finishes, so the shared
+    // state outlives this call; body is only touched while indices remain
+    struct State {
+        atomic<size_t> next{0};
+        size_t count = 0;
+        size_t finished = 0;
+        const function<void(size_t)> *body = nullptr;
+        exception_ptr error;
+        mutex lock;
+        condition_variable done;
+    };
+    auto state = make_shared<State>();
+    state->count = count;
+    state->body = &body;
+
+    auto run = [state] {
+        size_t i;
+        while ((i = state->next++) < state->count) {
+            exception_ptr error;
+            try {
+                (*state->body)(i);
+            } catch (...) {
+                error = current_exception();
+            }
+            lock_guard<mutex> guard(state->lock);
+            if (error && !state->error) state->error = error;
+            if (++state->finished == state->count) state->done.notify_all();
+        }
+    };
+
+    size_t helpers = min<size_t>(workers.size(), count - 1);
+    for (size_t h = 0; h < helpers; ++h) submit(run);
+    run();
+
+    unique_lock<mutex> guard(state->lock);
+    state->done.wait(guard, [&] { return state->finished == state->count; });
+    if (state->error) rethrow_exception(state->error);
+}
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
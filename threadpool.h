@@ -0,0 +1,44 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Fixed set of worker threads fed from a FIFO task queue
+class ThreadPool {
+public:
+    // 0 means one thread per hardware core
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned size() const { return workers.size(); }
+    void submit(function<void()> task);
+
+    // Runs body(i) for every i in [0, count) and returns when all are done.
+    // The calling thread works through indices too, so this is safe to call
+    // from inside a pool task. The first exception thrown is rethrown here.
+    void parallelFor(size_t count, const function<void(size_t)> &body);
+
+    // Process-wide pool shared by compressImage()/decompressImage()
+    static ThreadPool &shared();
+
+private:
+    void workerLoop();
+
+    vector<thread> workers;
+    queue<function<void()>> tasks;
+    mutex lock;
+    condition_variable wake;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "transform.h"
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+// Chroma is stored offset by 128 so typical values sit mid-range instead of
+// wrapping around 0, which would defeat the gradient predictors
+static const uint8_t kChromaBias = 128;
+
+static inline int asSigned(uint8_t v) { return int8_t(v); }
+
+// YCoCg-R lifting steps in mod-256 arithmetic; each step is exactly
+// invertible, so the transform is lossless on 8-bit data
+static void forwardColor(const uint8_t *in, uint8_t *out, size_t pixels, unsigned channels) {
+    for (size_t i = 0; i < pixels; ++i, in += channels, out += channels) {
+        uint8_t b = in[0], g = in[1], r = in[2];
+        uint8_t co = r - b;
+        uint8_t t = b + (asSigned(co) >> 1);
+        uint8_t cg = g - t;
+        uint8_t y = t + (asSigned(cg) >> 1);
+        out[0] = y;
+        out[1] = co + kChromaBias;
+        out[2] = cg + kChromaBias;
+        for (unsigned c = 3; c < channels; ++c) out[c] = in[c];
+    }
+}
+
+static void inverseColor(const uint8_t *in, uint8_t *out, size_t pixels, unsigned channels) {
+    for (size_t i = 0; i < pixels; ++i, in += channels, out += channels) {
+        uint8_t y = in[0];
+        uint8_t co = in[1] - kChromaBias;
+        uint8_t cg = in[2] - kChromaBias;
+        uint8_t t = y - (asSigned(cg) >> 1);
+        uint8_t g = cg + t;
+        uint8_t b = t - (asSigned(co) >> 1);
+        uint8_t r = b + co;
+        out[0] = b;
+        out[1] = g;
+        out[2] = r;
+        for (unsigned c = 3; c < channels; ++c) out[c] = in[c];
+    }
+}
+
+// Written with selects only so the row loops vectorise
+static inline uint8_t paeth(int a, int b, int c) {
+    int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+    int bc = pb <= pc ? b : c;
+    return (pa <= pb) & (pa <= pc) ? a : bc;
+}
+
+static inline uint8_t med(int a, int b, int c) {
+    int lo = a < b ? a : b, hi = a < b ? b : a;
+    if (c >= hi) return lo;
+    if (c <= lo) return hi;
+    return a + b - c;
+}
+
+// Prediction from the left (a), up (b) and up-left (c) neighbours.
+// Templated on the predictor so the per-byte loops carry no switch.
+template <Predictor P>
+static inline uint8_t predict(int a, int b, int c) {
+    switch (P) {
+    case Predictor::Left: return a;
+    case Predictor::Up: return b;
+    case Predictor::Paeth: return paeth(a, b, c);
+    case Predictor::Med: return med(a, b, c);
+    default: return 0;
+    }
+}
+
+// The first pixel of a row has no left neighbours; `up` is a zero row on the
+// first row of a block
+template <Predictor P>
+static void predictRow(const uint8_t *row, const uint8_t *up, size_t rowBytes, unsigned channels, uint8_t *out) {
+    for (size_t i = 0; i < channels; ++i) out[i] = row[i] - predict<P>(0, up[i], 0);
+    for (size_t i = channels; i < rowBytes; ++i) out[i] = row[i] - predict<P>(row[i - channels], up[i], up[i - channels]);
+}
+
+// Each byte only depends on bytes already reconstructed to its left and in
+// the row above
+template <Predictor P>
+static void unpredictRow(const uint8_t *residuals, const uint8_t *up, size_t rowBytes, unsigned channels, uint8_t *row) {
+    for (size_t i = 0; i < channels; ++i) row[i] = residuals[i] + predict<P>(0, up[i], 0);
+    for (size_t i = channels; i < rowBytes; ++i) row[i] = residuals[i] + predict<P>(row[i - channels], up[i], up[i - channels]);
+}
+
+template <Predictor P>
+static uint64_t residualCost(const uint8_t *row, const uint8_t *up, size_t rowBytes, unsigned channels) {
+    uint64_t cost = 0;
+    for (size_t i = 0; i < channels; ++i) cost += abs(asSigned(uint8_t(row[i] - predict<P>(0, up[i], 0))));
+    for (size_t i = channels; i < rowBytes; ++i) {
+        cost += abs(asSigned(uint8_t(row[i] - predict<P>(row[i - channels], up[i], up[i - channels]))));
+    }
+    return cost;
+}
+
+typedef void (*RowFilter)(const uint8_t*, const uint8_t*, size_t, unsigned, uint8_t*);
+typedef uint64_t (*RowCost)(const uint8_t*, const uint8_t*, size_t, unsigned);
+
+// Indexed by Predictor value
+static const RowFilter kPredictRow[kPredictorCount] = {
+    predictRow<Predictor::None>, predictRow<Predictor::Left>, predictRow<Predictor::Up>,
+    predictRow<Predictor::Paeth>, predictRow<Predictor::Med>
+};
+static const RowFilter kUnpredictRow[kPredictorCount] = {
+    unpredictRow<Predictor::None>, unpredictRow<Predictor::Left>, unpredictRow<Predictor::Up>,
+    unpredictRow<Predictor::Paeth>, unpredictRow<Predictor::Med>
+};
+static const RowCost kResidualCost[kPredictorCount] = {
+    residualCost<Predictor::None>, residualCost<Predictor::Left>, residualCost<Predictor::Up>,
+    residualCost<Predictor::Paeth>, residualCost<Predictor::Med>
+};
+
+void forwardTransform(const PixelView &block, unsigned channels, const TransformOptions &options,
+                      uint8_t *residuals, uint8_t *rowPredictors) {
+    size_t rowBytes = block.rowBytes;
+    bool color = options.color == ColorTransform::YCoCgR && channels >= 3;
+    // A zero row stands in above the first row, then two rows of colour
+    // transformed pixels when they can't be read from the block directly
+    vector<uint8_t> rows((color ? 3 : 1) * rowBytes);
+    const uint8_t *up = rows.data();
+    uint8_t *current = rows.data() + rowBytes, *previous = current + rowBytes;
+
+    for (size_t y = 0; y < block.rows; ++y) {
+        const uint8_t *row = block.row(y);
+        if (color) {
+            forwardColor(row, current, rowBytes / channels, channels);
+            row = current;
+        }
+
+        Predictor chosen = options.predictor;
+        if (chosen == Predictor::Adaptive) {
+            uint64_t bestCost = UINT64_MAX;
+            for (unsigned p = 0; p < kPredictorCount; ++p) {
+                uint64_t cost = kResidualCost[p](row, up, rowBytes, channels);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    chosen = Predictor(p);
+                }
+            }
+        }
+        if (rowPredictors) rowPredictors[y] = uint8_t(chosen);
+        kPredictRow[uint8_t(chosen)](row, up, rowBytes, channels, residuals + y * rowBytes);
+
+        if (color) {
+            swap(current, previous);
+            up = previous;
+        } else {
+            up = block.row(y);
+        }
+    }
+}
+
+void inverseTransform(const MutablePixelView &block, unsigned channels, ColorTransform color,
+                      const uint8_t *rowPredictors) {
+    size_t rowBytes = block.rowBytes;
+    bool useColor = color == ColorTransform::YCoCgR && channels >= 3;
+    // A zero row stands in above the first row, then two rows of colour
+    // transformed pixels when they can't be read from the block directly
+    vector<uint8_t> rows((useColor ? 3 : 1) * rowBytes);
+    const uint8_t *up = rows.data();
+    uint8_t *current = rows.data() + rowBytes, *previous = current + rowBytes;
+
+    for (size_t y = 0; y < block.rows; ++y) {
+        uint8_t *out = block.row(y);
+        uint8_t *row = useColor ? current : out;
+        Predictor p = rowPredictors ? Predictor(rowPredictors[y]) : Predictor::None;
+        if (uint8_t(p) >= kPredictorCount) {
+            throw runtime_error("Invalid row predictor!");
+        }
+        kUnpredictRow[uint8_t(p)](out, up, rowBytes, channels, row);
+
+        if (useColor) {
+            inverseColor(current, out, rowBytes / channels, channels);
+            swap(current, previous);
+            up = previous;
+        } else {
+            up = out;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cstdint>
+#include <vector>
+#include "pixelview.h"
+
+using namespace std;
+
+// Spatial predictor applied per channel before entropy coding. The residual
+// x - prediction (mod 256) is what gets Huffman coded.
+enum class Predictor : uint8_t {
+    None = 0,
+    Left = 1,
+    Up = 2,
+    Paeth = 3,   // PNG
+    Med = 4,     // LOCO-I / JPEG-LS median edge detector
+    Adaptive = 255  // Pick the cheapest of the above for each row
+};
+
+const unsigned kPredictorCount = 5;
+
+// Reversible decorrelation of the B, G, R bytes before prediction
+enum class ColorTransform : uint8_t {
+    None = 0,
+    YCoCgR = 1
+};
+
+struct TransformOptions {
+    ColorTransform color = ColorTransform::YCoCgR;
+    Predictor predictor = Predictor::Adaptive;
+
+    bool enabled() const { return color != ColorTransform::None || predictor != Predictor::None; }
+};
+
+// Transforms a block of rows into residual bytes (rowBytes * rows, tightly
+// packed) and records the predictor used for each row; rowPredictors may be
+// null when options.predictor is None. Rows above the block are never
+// referenced, so blocks stay independently decodable.
+void forwardTransform(const PixelView &block, unsigned channels, const TransformOptions &options,
+                      uint8_t *residuals, uint8_t *rowPredictors);
+
+// Undoes forwardTransform() in place: block holds residuals on entry and
+// pixels on return. A null rowPredictors means no prediction was applied.
+void inverseTransform(const MutablePixelView &block, unsigned channels, ColorTransform color,
+                      const uint8_t *rowPredictors);
+
+#endif
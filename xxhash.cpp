@@ -0,0 +1,78 @@
+#include "xxhash.h"
+#include <cstring>
+
+using namespace std;
+
+static const uint64_t kPrime1 = 0x9e3779b185ebca87ull;
+static const uint64_t kPrime2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t kPrime3 = 0x165667b19e3779f9ull;
+static const uint64_t kPrime4 = 0x85ebca77c2b2ae63ull;
+static const uint64_t kPrime5 = 0x27d4eb2f165667c5ull;
+
+static inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t loadLE64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t loadLE32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t mixRound(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    return rotl(acc, 31) * kPrime1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+    acc ^= mixRound(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+uint64_t xxh64(const uint8_t *data, size_t size, uint64_t seed) {
+    const uint8_t *end = data + size;
+    uint64_t h;
+
+    // Four independent lanes over 32-byte stripes
+    if (size >= 32) {
+        uint64_t v1 = seed + kPrime1 + kPrime2, v2 = seed + kPrime2, v3 = seed, v4 = seed - kPrime1;
+        for (; end - data >= 32; data += 32) {
+            v1 = mixRound(v1, loadLE64(data));
+            v2 = mixRound(v2, loadLE64(data + 8));
+            v3 = mixRound(v3, loadLE64(data + 16));
+            v4 = mixRound(v4, loadLE64(data + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    } else {
+        h = seed + kPrime5;
+    }
+    h += uint64_t(size);
+
+    for (; end - data >= 8; data += 8) h = rotl(h ^ mixRound(0, loadLE64(data)), 27) * kPrime1 + kPrime4;
+    if (end - data >= 4) {
+        h = rotl(h ^ (uint64_t(loadLE32(data)) * kPrime1), 23) * kPrime2 + kPrime3;
+        data += 4;
+    }
+    for (; data < end; ++data) h = rotl(h ^ (*data * kPrime5), 11) * kPrime1;
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
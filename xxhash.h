@@ -0,0 +1,14 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// XXH64 of data[0, size). Not cryptographic, but fast enough (several GB/s)
+// to fingerprint whole files, with the same results as the reference
+// implementation for the same seed.
+uint64_t xxh64(const uint8_t *data, size_t size, uint64_t seed = 0);
+
+#endif